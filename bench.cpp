@@ -0,0 +1,383 @@
+/// @file bench.cpp
+/// @brief Сквозной бенчмарк транспортов сервера отсечения
+///
+/// Один и тот же набор запросов прогоняется через каждый транспорт сервера на одной машине:
+/// TCP с соединением на запрос, постоянный TCP, Unix-сокет, UDP и общую память.
+/// Для каждого транспорта печатаются пропускная способность, перцентили задержки
+/// и процессорное время на запрос (клиента и, если передан --server-pid, сервера).
+///
+/// Пример: ./bench --requests 20000 --clients 4 --mix realistic --server-pid $(pidof server)
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "transport.h"
+
+/// @brief Многоугольник как список координат в порядке обхода
+using Ring = std::vector<std::pair<double, double>>;
+
+/// @brief Правильный многоугольник с дрожанием радиуса (обход против часовой стрелки)
+Ring makeRing(int n, double cx, double cy, double r, double jitter, std::mt19937& rng) {
+    std::uniform_real_distribution<double> d(1.0 - jitter, 1.0);
+    Ring ring;
+    for (int i = 0; i < n; ++i) {
+        double a = 2 * M_PI * i / n, k = r * d(rng);
+        ring.push_back({cx + k * std::cos(a), cy + k * std::sin(a)});
+    }
+    return ring;
+}
+
+/// @brief Сформировать текст запроса в формате сервера
+std::string formatRequest(const Ring& s, const Ring& p) {
+    std::ostringstream oss;
+    oss.precision(17);
+    oss << s.size() << " ";
+    for (auto& v : s) oss << v.first << " " << v.second << " ";
+    oss << p.size() << " ";
+    for (auto& v : p) oss << v.first << " " << v.second << " ";
+    oss << "\n";
+    return oss.str();
+}
+
+/// @brief Набор запросов для прогона
+/// @param mix "triangles" — треугольники из autoclient.cpp, "realistic" — смесь размеров
+/// @param count Число запросов
+std::vector<std::string> makeRequests(const std::string& mix, int count) {
+    const Ring s_tri = {{0, 0}, {2, 0}, {1, 3}};
+    const Ring p_tri = {{0, 2}, {1, -1}, {2, 2}};
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> pick(0, 1), shift(-0.3, 0.3);
+    std::vector<std::string> requests;
+    for (int i = 0; i < count; ++i) {
+        double r = mix == "triangles" ? 0 : pick(rng);
+        if (r < 0.5) {
+            requests.push_back(formatRequest(s_tri, p_tri));
+        } else {
+            // 30% — 16 вершин, 15% — 128, 5% — 1024; окно частично перекрывает субъект
+            int n = r < 0.8 ? 16 : (r < 0.95 ? 128 : 1024);
+            int m = r < 0.8 ? 4 : (r < 0.95 ? 8 : 16);
+            Ring s = makeRing(n, 0, 0, 1, 0.2, rng);
+            Ring p = makeRing(m, shift(rng), shift(rng), 0.8, 0.0, rng);
+            requests.push_back(formatRequest(s, p));
+        }
+    }
+    return requests;
+}
+
+/// @brief Проверить, что ответ полный и корректный (OK с вершинами или FAIL)
+bool validResponse(std::istream& in) {
+    std::string status;
+    if (!(in >> status)) return false;
+    if (status == "FAIL") return true;
+    if (status != "OK") return false;
+    int n;
+    if (!(in >> n)) return false;
+    for (int i = 0; i < n; ++i) {
+        double x, y;
+        if (!(in >> x >> y)) return false;
+    }
+    return true;
+}
+
+/// @class Transport
+/// @brief Клиентская сторона одного транспорта: отправить запрос и дождаться ответа
+class Transport {
+public:
+    virtual ~Transport() {}
+    /// @brief Выполнить запрос
+    /// @return true если получен корректный ответ
+    virtual bool roundTrip(const std::string& request) = 0;
+};
+
+/// @brief Подключиться к TCP-порту на localhost
+int connectTcp(int port) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in serv_addr{AF_INET, htons(port)};
+    inet_pton(AF_INET, "127.0.0.1", &serv_addr.sin_addr);
+    if (connect(sock, (sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/// @class TcpPerConnection
+/// @brief Исходный режим: новое соединение на каждый запрос
+class TcpPerConnection : public Transport {
+public:
+    bool roundTrip(const std::string& request) override {
+        int sock = connectTcp(TCP_PORT);
+        if (sock < 0) return false;
+        bool ok = sendAll(sock, request);
+        shutdown(sock, SHUT_WR);
+        FdStreamBuf buf(sock);
+        std::istream in(&buf);
+        ok = ok && validResponse(in);
+        close(sock);
+        return ok;
+    }
+};
+
+/// @class StreamSession
+/// @brief Постоянное потоковое соединение (TCP или Unix-сокет)
+class StreamSession : public Transport {
+public:
+    /// @brief Конструктор
+    /// @param sock Подключённый сокет
+    explicit StreamSession(int sock) : _sock(sock), _buf(sock), _in(&_buf) {}
+    ~StreamSession() override { if (_sock >= 0) close(_sock); }
+
+    bool roundTrip(const std::string& request) override {
+        return _sock >= 0 && sendAll(_sock, request) && validResponse(_in);
+    }
+
+private:
+    int _sock;          ///< Сокет соединения
+    FdStreamBuf _buf;   ///< Буфер чтения ответов
+    std::istream _in;   ///< Поток ответов
+};
+
+/// @brief Подключиться к Unix-сокету сервера
+int connectUnix() {
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, UNIX_SOCKET_PATH, sizeof(address.sun_path) - 1);
+    if (connect(sock, (sockaddr*)&address, sizeof(address)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/// @class Udp
+/// @brief Одна датаграмма на запрос; потеря ответа считается ошибкой
+class Udp : public Transport {
+public:
+    Udp() : _sock(socket(AF_INET, SOCK_DGRAM, 0)), _buffer(UDP_MAX_DATAGRAM) {
+        sockaddr_in serv_addr{AF_INET, htons(UDP_PORT)};
+        inet_pton(AF_INET, "127.0.0.1", &serv_addr.sin_addr);
+        connect(_sock, (sockaddr*)&serv_addr, sizeof(serv_addr));
+        timeval timeout{1, 0};
+        setsockopt(_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+    ~Udp() override { close(_sock); }
+
+    bool roundTrip(const std::string& request) override {
+        if (request.size() > UDP_MAX_DATAGRAM) return false;
+        if (send(_sock, request.data(), request.size(), 0) < 0) return false;
+        ssize_t n = recv(_sock, _buffer.data(), _buffer.size(), 0);
+        if (n <= 0) return false;
+        std::istringstream in(std::string(_buffer.data(), n));
+        return validResponse(in);
+    }
+
+private:
+    int _sock;                 ///< Подключённый UDP-сокет
+    std::vector<char> _buffer; ///< Буфер ответа
+};
+
+/// @class SharedMemory
+/// @brief Запрос и ответ через сегмент общей памяти сервера
+class SharedMemory : public Transport {
+public:
+    SharedMemory() : _channel(nullptr) {
+        int fd = shm_open(SHM_NAME, O_RDWR, 0);
+        if (fd < 0) return;
+        void* mem = mmap(nullptr, sizeof(ShmChannel), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mem != MAP_FAILED) _channel = static_cast<ShmChannel*>(mem);
+    }
+    ~SharedMemory() override { if (_channel) munmap(_channel, sizeof(ShmChannel)); }
+
+    bool roundTrip(const std::string& request) override {
+        if (!_channel || request.size() > SHM_CAPACITY) return false;
+        sem_wait(&_channel->lock);
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += 2;
+        // Запрос, брошенный по таймауту, ещё в работе: его ответ лёг бы поверх нового запроса
+        bool ok = true;
+        while (ok && _channel->answered != _channel->sequence)
+            ok = sem_timedwait(&_channel->response, &deadline) == 0;
+        if (ok) {
+            std::memcpy(_channel->data, request.data(), request.size());
+            _channel->length = request.size();
+            uint32_t sequence = ++_channel->sequence;
+            sem_post(&_channel->request);
+            // Подъём response от уже отброшенного ответа пропускается по номеру
+            do ok = sem_timedwait(&_channel->response, &deadline) == 0;
+            while (ok && _channel->answered != sequence);
+        }
+        if (ok) {
+            std::istringstream in(std::string(_channel->data, _channel->length));
+            ok = validResponse(in);
+        }
+        sem_post(&_channel->lock);
+        return ok;
+    }
+
+private:
+    ShmChannel* _channel; ///< Отображённый канал
+};
+
+/// @brief Создать клиента транспорта по имени
+std::unique_ptr<Transport> makeTransport(const std::string& name) {
+    if (name == "tcp") return std::unique_ptr<Transport>(new TcpPerConnection());
+    if (name == "persistent") return std::unique_ptr<Transport>(new StreamSession(connectTcp(TCP_PERSISTENT_PORT)));
+    if (name == "unix") return std::unique_ptr<Transport>(new StreamSession(connectUnix()));
+    if (name == "udp") return std::unique_ptr<Transport>(new Udp());
+    if (name == "shm") return std::unique_ptr<Transport>(new SharedMemory());
+    throw std::runtime_error("Unknown transport " + name);
+}
+
+/// @brief Процессорное время текущего процесса, микросекунды
+double selfCpuMicros() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6
+         + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/// @brief Процессорное время другого процесса по /proc/<pid>/stat, микросекунды
+/// @return -1 если процесс недоступен
+double processCpuMicros(int pid) {
+    if (pid <= 0) return -1;
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    if (!std::getline(stat, line)) return -1;
+    // Поле comm может содержать пробелы, поэтому разбор начинается после ')'
+    std::istringstream iss(line.substr(line.rfind(')') + 2));
+    std::string field;
+    double utime = 0, stime = 0;
+    for (int i = 3; i <= 15 && iss >> field; ++i) {
+        if (i == 14) utime = std::stod(field);
+        if (i == 15) stime = std::stod(field);
+    }
+    return (utime + stime) * 1e6 / sysconf(_SC_CLK_TCK);
+}
+
+/// @struct RunResult
+/// @brief Итог прогона одного транспорта
+struct RunResult {
+    std::vector<double> latencies; ///< Задержки успешных запросов, микросекунды
+    int errors = 0;                ///< Неудачные запросы
+    double seconds = 0;            ///< Время прогона
+    double clientCpu = 0;          ///< Процессорное время клиента, микросекунды
+    double serverCpu = -1;         ///< Процессорное время сервера, микросекунды
+};
+
+/// @brief Прогнать запросы через транспорт несколькими клиентами
+RunResult run(const std::string& name, const std::vector<std::string>& requests, int clients, int serverPid) {
+    typedef std::chrono::steady_clock clock;
+    RunResult result;
+    std::vector<std::vector<double>> latencies(clients);
+    std::vector<int> errors(clients, 0);
+
+    double cpu0 = selfCpuMicros(), server0 = processCpuMicros(serverPid);
+    auto start = clock::now();
+    std::vector<std::thread> threads;
+    for (int c = 0; c < clients; ++c) {
+        threads.emplace_back([&, c]() {
+            std::unique_ptr<Transport> transport = makeTransport(name);
+            for (size_t i = c; i < requests.size(); i += clients) {
+                auto t0 = clock::now();
+                bool ok = transport->roundTrip(requests[i]);
+                auto t1 = clock::now();
+                if (ok) latencies[c].push_back(std::chrono::duration<double, std::micro>(t1 - t0).count());
+                else errors[c]++;
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    result.seconds = std::chrono::duration<double>(clock::now() - start).count();
+    result.clientCpu = selfCpuMicros() - cpu0;
+    double server1 = processCpuMicros(serverPid);
+    if (server0 >= 0 && server1 >= 0) result.serverCpu = server1 - server0;
+
+    for (int c = 0; c < clients; ++c) {
+        result.latencies.insert(result.latencies.end(), latencies[c].begin(), latencies[c].end());
+        result.errors += errors[c];
+    }
+    std::sort(result.latencies.begin(), result.latencies.end());
+    return result;
+}
+
+/// @brief Перцентиль отсортированного массива
+double percentile(const std::vector<double>& sorted, double q) {
+    if (sorted.empty()) return 0;
+    size_t i = std::min(sorted.size() - 1, (size_t)(q * sorted.size()));
+    return sorted[i];
+}
+
+/// @brief Основная функция бенчмарка
+int main(int argc, char** argv) {
+    int count = 10000, clients = 1, serverPid = 0;
+    std::string mix = "realistic", transports = "tcp,persistent,unix,udp,shm";
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i], value = argv[i + 1];
+        if (key == "--requests") count = std::stoi(value);
+        else if (key == "--clients") clients = std::max(1, std::stoi(value));
+        else if (key == "--server-pid") serverPid = std::stoi(value);
+        else if (key == "--mix") mix = value;
+        else if (key == "--transports") transports = value;
+        else {
+            std::cerr << "Unknown option " << key << "\n";
+            return 1;
+        }
+    }
+
+    std::vector<std::string> requests = makeRequests(mix, count);
+    std::vector<std::string> warmup(requests.begin(), requests.begin() + std::min<size_t>(requests.size(), 200));
+
+    std::cout << std::left << std::setw(12) << "transport" << std::right
+              << std::setw(10) << "req/s" << std::setw(9) << "p50us" << std::setw(9) << "p90us"
+              << std::setw(9) << "p99us" << std::setw(10) << "p99.9us" << std::setw(10) << "maxus"
+              << std::setw(12) << "cli_cpu/req" << std::setw(12) << "srv_cpu/req" << std::setw(8) << "errors" << "\n";
+    std::cout << std::fixed << std::setprecision(1);
+
+    std::istringstream names(transports);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+        try {
+            run(name, warmup, clients, 0);
+            RunResult r = run(name, requests, clients, serverPid);
+            size_t done = r.latencies.size();
+            std::cout << std::left << std::setw(12) << name << std::right
+                      << std::setw(10) << done / r.seconds
+                      << std::setw(9) << percentile(r.latencies, 0.50)
+                      << std::setw(9) << percentile(r.latencies, 0.90)
+                      << std::setw(9) << percentile(r.latencies, 0.99)
+                      << std::setw(10) << percentile(r.latencies, 0.999)
+                      << std::setw(10) << (done ? r.latencies.back() : 0.0)
+                      << std::setw(12) << r.clientCpu / std::max<size_t>(done, 1);
+            if (r.serverCpu >= 0) std::cout << std::setw(12) << r.serverCpu / std::max<size_t>(done, 1);
+            else std::cout << std::setw(12) << "-";
+            std::cout << std::setw(8) << r.errors << "\n";
+            if (name == "shm" && clients > 1)
+                std::cout << "  shm: one request in flight at a time, clients are serialized on the channel\n";
+        } catch (const std::exception& e) {
+            std::cerr << name << ": " << e.what() << "\n";
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,167 @@
+/// @file clip_client.h
+/// @brief Клиентская библиотека сервера отсечения с локальной обработкой простых запросов
+
+#pragma once
+
+#include <istream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include "geometry.h"
+#include "transport.h"
+
+/// @brief Наибольшая работа "вершин субъекта x вершин отсекателя", выполняемая на месте
+constexpr size_t CLIENT_LOCAL_MAX_WORK = 1024;
+
+/// @class ClipClient
+/// @brief Клиент отсечения "s_size s... p_size p..." с предварительным фильтром
+///
+/// До обращения к серверу запрос проверяется на месте: если ограничивающие прямоугольники
+/// не пересекаются, ответ пуст; если все вершины субъекта лежат внутри всех рёбер
+/// отсекателя, ответ — сам субъект. Небольшие запросы выполняются встроенным ядром
+/// geometry.h, остальные уходят на сервер по постоянному соединению.
+class ClipClient {
+public:
+    /// @brief Конструктор
+    /// @param host IPv4-адрес сервера
+    /// @param port Порт постоянного соединения
+    /// @param localMaxWork Порог работы для локального отсечения; 0 — всегда на сервере
+    explicit ClipClient(const std::string& host = "127.0.0.1", int port = TCP_PERSISTENT_PORT,
+                        size_t localMaxWork = CLIENT_LOCAL_MAX_WORK)
+        : _host(host), _port(port), _localMaxWork(localMaxWork), _sock(-1),
+          _trivial(0), _local(0), _remote(0) {}
+
+    ClipClient(const ClipClient&) = delete;
+    ClipClient& operator=(const ClipClient&) = delete;
+
+    /// @brief Деструктор: закрывает соединение
+    ~ClipClient() { disconnect(); }
+
+    /// @brief Отсечь субъект отсекателем
+    /// @param subject Вершины субъекта
+    /// @param clipper Вершины отсекателя (любая ориентация обхода)
+    /// @param result Вершины результата
+    /// @return true если результат не пуст
+    /// @throws std::runtime_error при ошибке соединения или ответе "ERROR"
+    bool clip(const std::vector<Point>& subject, const std::vector<Point>& clipper, std::vector<Point>& result) {
+        result.clear();
+        ClipPlan plan(clipper);
+        if (subject.empty() || !plan.valid() ||
+            !boundingBox(subject.data(), subject.size()).intersects(boundingBox(clipper.data(), clipper.size()))) {
+            ++_trivial;
+            return false;
+        }
+        if (insideAll(subject, plan)) {
+            ++_trivial;
+            result = subject;
+            return true;
+        }
+        if (subject.size() * clipper.size() <= _localMaxWork) {
+            ++_local;
+            return clipLocal(subject, plan, result);
+        }
+        ++_remote;
+        return clipRemote(subject, clipper, result);
+    }
+
+    /// @brief Запросов, решённых фильтром без отсечения
+    size_t trivialCount() const { return _trivial; }
+    /// @brief Запросов, отсечённых на месте
+    size_t localCount() const { return _local; }
+    /// @brief Запросов, отправленных на сервер
+    size_t remoteCount() const { return _remote; }
+
+private:
+    /// @brief Все вершины внутри всех рёбер плана: отсечение их не меняет
+    static bool insideAll(const std::vector<Point>& subject, const ClipPlan& plan) {
+        for (size_t k = 0; k < plan.size(); ++k)
+            for (const Point& v : subject)
+                if (plan.a[k] * v.x + plan.b[k] * v.y + plan.c[k] > 0) return false;
+        return true;
+    }
+
+    /// @brief Отсечение встроенным ядром тем же алгоритмом, что и на сервере
+    static bool clipLocal(const std::vector<Point>& subject, const ClipPlan& plan, std::vector<Point>& result) {
+        Polygon s;
+        for (const Point& v : subject) s.insert(v);
+        Polygon* clipped = nullptr;
+        if (!clipPolygon(s, plan, clipped)) return false;
+        Vertex* v = clipped->_v;
+        do {
+            result.push_back(*v);
+            v = v->cw();
+        } while (v != clipped->_v);
+        delete clipped;
+        return true;
+    }
+
+    /// @brief Отсечение на сервере; при обрыве соединение открывается заново один раз
+    bool clipRemote(const std::vector<Point>& subject, const std::vector<Point>& clipper, std::vector<Point>& result) {
+        std::ostringstream request;
+        request.precision(17);
+        for (const auto* points : {&subject, &clipper}) {
+            request << points->size();
+            for (const Point& v : *points) request << " " << v.x << " " << v.y;
+            request << "\n";
+        }
+        std::string status;
+        for (int attempt = 0; attempt < 2 && status.empty(); ++attempt) {
+            if (_sock < 0) connectServer();
+            if (!sendAll(_sock, request.str())) {
+                disconnect();
+                continue;
+            }
+            _in.clear();
+            if (!(_in >> status)) disconnect();
+        }
+        if (status == "FAIL") return false;
+        size_t n;
+        if (status != "OK" || !(_in >> n)) {
+            disconnect();
+            throw std::runtime_error("Clip request failed");
+        }
+        result.resize(n);
+        for (Point& v : result)
+            if (!(_in >> v.x >> v.y)) {
+                disconnect();
+                throw std::runtime_error("Truncated response");
+            }
+        return true;
+    }
+
+    /// @brief Открыть постоянное соединение
+    /// @throws std::runtime_error если сервер недоступен
+    void connectServer() {
+        _sock = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address{AF_INET, htons(_port)};
+        inet_pton(AF_INET, _host.c_str(), &address.sin_addr);
+        if (_sock < 0 || connect(_sock, (sockaddr*)&address, sizeof(address)) < 0) {
+            disconnect();
+            throw std::runtime_error("Connection failed");
+        }
+        _buf.reset(new FdStreamBuf(_sock));
+        _in.rdbuf(_buf.get());
+    }
+
+    /// @brief Закрыть соединение
+    void disconnect() {
+        if (_sock >= 0) close(_sock);
+        _sock = -1;
+        _in.rdbuf(nullptr);
+        _buf.reset();
+    }
+
+    std::string _host;                 ///< Адрес сервера
+    int _port;                         ///< Порт сервера
+    size_t _localMaxWork;              ///< Порог локального отсечения
+    int _sock;                         ///< Сокет соединения (-1 — не открыт)
+    std::unique_ptr<FdStreamBuf> _buf; ///< Буфер чтения ответов
+    std::istream _in{nullptr};         ///< Поток ответов
+    size_t _trivial;                   ///< Счётчик запросов, решённых фильтром
+    size_t _local;                     ///< Счётчик локальных отсечений
+    size_t _remote;                    ///< Счётчик запросов к серверу
+};
@@ -0,0 +1,624 @@
+/// @file geometry.h
+/// @brief Ядро отсечения Сазерленда-Ходжмана: точки, рёбра, многоугольники и планы отсекателей
+///
+/// Заголовок не зависит от сервера и может встраиваться в другие программы.
+/// Базовые вычисления (Point, Edge, классификация, ориентация, ограничивающий
+/// прямоугольник, FixedClipPlan) доступны в constexpr-контексте.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <deque>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+/// @brief Половина стороны квадрата, замыкающего неограниченное пересечение полуплоскостей
+constexpr double HALFPLANE_BOUND = 1e9;
+/// @brief Допуск на расстояние и параллельность при пересечении полуплоскостей
+constexpr double HALFPLANE_EPSILON = 1e-12;
+
+/// @enum PointClass
+/// @brief Классификация положения точки относительно ребра
+enum PointClass { LEFT, RIGHT, BEHIND, BEYOND, BETWEEN, ORIGIN, DESTINATION };
+
+/// @enum Rotation
+/// @brief Направление обхода вершин
+enum Rotation { CLOCKWISE, COUNTER_CLOCKWISE };
+
+class Edge;
+
+/// @class Point
+/// @brief Класс для представления точки в 2D пространстве
+class Point {
+public:
+    double x, y; ///< Координаты точки
+    
+    /// @brief Конструктор точки
+    /// @param x Координата X (по умолчанию 0)
+    /// @param y Координата Y (по умолчанию 0)
+    constexpr Point(double x = 0, double y = 0) : x(x), y(y) {}
+    
+    /// @brief Оператор сравнения точек
+    constexpr bool operator==(const Point& other) const {
+        return (x - other.x)*(x - other.x) + (y - other.y)*(y - other.y) < 1e-15;
+    }
+    
+    /// @brief Оператор неравенства точек
+    constexpr bool operator!=(const Point& other) const { return !(*this == other); }
+    
+    /// @brief Вычитание точек (векторная операция)
+    constexpr Point operator-(const Point& other) const { return Point(x - other.x, y - other.y); }
+    
+    /// @brief Длина вектора от начала координат
+    double length() const { return std::sqrt(x * x + y * y); }
+
+    /// @brief Квадрат длины вектора (доступен при компиляции)
+    constexpr double norm2() const { return x * x + y * y; }
+    
+    /// @brief Классификация точки относительно ребра
+    /// @param e Ребро для классификации
+    constexpr PointClass classify(const Edge& e) const;
+};
+
+/// @class Edge
+/// @brief Класс для представления ребра многоугольника
+class Edge {
+public:
+    Point org; ///< Начальная точка ребра
+    Point dest; ///< Конечная точка ребра
+    
+    /// @brief Конструктор ребра
+    /// @param org Начальная точка
+    /// @param dest Конечная точка
+    constexpr Edge(const Point& org, const Point& dest) : org(org), dest(dest) {}
+    
+    /// @brief Получить точку на ребре по параметру t
+    /// @param t Параметр от 0 до 1
+    constexpr Point point(double t) const {
+        return Point(org.x + t*(dest.x - org.x), org.y + t*(dest.y - org.y)); 
+    }
+    
+    /// @brief Поиск пересечения с другим ребром
+    /// @param e Ребро для проверки пересечения
+    /// @param[out] t Параметр точки пересечения
+    /// @return true если пересечение существует
+    constexpr bool intersect(const Edge& e, double& t) const;
+};
+
+// Реализация методов класса Point
+constexpr PointClass Point::classify(const Edge& e) const {
+    Point a = e.dest - e.org;
+    Point b = *this - e.org;
+    double sa = a.x * b.y - b.x * a.y;
+    if (sa > 0.0) return LEFT;
+    if (sa < 0.0) return RIGHT;
+    if ((a.x * b.x < 0.0) || (a.y * b.y < 0.0)) return BEHIND;
+    if (a.norm2() < b.norm2()) return BEYOND;
+    if (e.org == *this) return ORIGIN;
+    if (e.dest == *this) return DESTINATION;
+    return BETWEEN;
+}
+
+// Реализация методов класса Edge
+constexpr bool Edge::intersect(const Edge& e, double& t) const {
+    double a = dest.x - org.x, b = e.org.x - e.dest.x;
+    double c = dest.y - org.y, d = e.org.y - e.dest.y;
+    double denom = a * d - b * c;
+    if ((denom < 0 ? -denom : denom) < 1e-15) return false;
+    double e1 = e.org.x - org.x, e2 = e.org.y - org.y;
+    t = (e1 * d - e2 * b) / denom;
+    double u = (e1 * c - e2 * a) / denom;
+    return t >= 0 && t <= 1 && u >= 0 && u <= 1;
+}
+
+/// @brief Векторное произведение (b - a) x (c - a)
+constexpr double cross(const Point& a, const Point& b, const Point& c) {
+    return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+}
+
+/// @brief Ориентированная площадь кольца (> 0 — обход против часовой стрелки)
+/// @param ring Вершины кольца
+/// @param n Число вершин
+constexpr double signedArea(const Point* ring, size_t n) {
+    double area = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const Point& p = ring[i];
+        const Point& q = ring[(i + 1) % n];
+        area += p.x * q.y - q.x * p.y;
+    }
+    return area / 2;
+}
+
+/// @brief Ориентированная площадь кольца (> 0 — обход против часовой стрелки)
+inline double signedArea(const std::vector<Point>& ring) { return signedArea(ring.data(), ring.size()); }
+
+/// @struct BBox
+/// @brief Ограничивающий прямоугольник
+struct BBox {
+    static constexpr double INF = std::numeric_limits<double>::infinity();
+    double minX = INF, minY = INF, maxX = -INF, maxY = -INF; ///< Границы (пустой — бесконечные)
+
+    /// @brief Расширить прямоугольник точкой
+    constexpr void add(const Point& v) {
+        minX = std::min(minX, v.x);
+        minY = std::min(minY, v.y);
+        maxX = std::max(maxX, v.x);
+        maxY = std::max(maxY, v.y);
+    }
+
+    /// @brief Расширить прямоугольник другим прямоугольником
+    constexpr void add(const BBox& b) {
+        minX = std::min(minX, b.minX);
+        minY = std::min(minY, b.minY);
+        maxX = std::max(maxX, b.maxX);
+        maxY = std::max(maxY, b.maxY);
+    }
+
+    /// @brief Прямоугольники пересекаются (включая касание)
+    constexpr bool intersects(const BBox& b) const {
+        return minX <= b.maxX && b.minX <= maxX && minY <= b.maxY && b.minY <= maxY;
+    }
+};
+
+/// @brief Ограничивающий прямоугольник вершин
+constexpr BBox boundingBox(const Point* points, size_t n) {
+    BBox box;
+    for (size_t i = 0; i < n; ++i) box.add(points[i]);
+    return box;
+}
+
+/// @class Vertex
+/// @brief Вершина многоугольника с указателями на соседей
+class Vertex : public Point {
+public:
+    Vertex* _next; ///< Следующая вершина (по часовой стрелке)
+    Vertex* _prev; ///< Предыдущая вершина (против часовой стрелки)
+    
+    /// @brief Основной конструктор
+    /// @param x Координата X
+    /// @param y Координата Y
+    Vertex(double x = 0, double y = 0) : Point(x, y), _next(nullptr), _prev(nullptr) {}
+    
+    /// @brief Конструктор из точки
+    /// @param p Исходная точка
+    Vertex(const Point& p) : Point(p), _next(nullptr), _prev(nullptr) {}
+    
+    /// @brief Получить следующую вершину
+    Vertex* cw() { return _next; }
+    
+    /// @brief Получить предыдущую вершину
+    Vertex* ccw() { return _prev; }
+    
+    /// @brief Получить соседа по направлению
+    /// @param rotation Направление (CLOCKWISE/COUNTER_CLOCKWISE)
+    Vertex* neighbor(int rotation) { return (rotation == CLOCKWISE) ? cw() : ccw(); }
+    
+    /// @brief Вставить вершину после текущей
+    /// @param v Вершина для вставки
+    Vertex* insert(Vertex* v) {
+        v->_next = _next;
+        v->_prev = this;
+        if (_next) _next->_prev = v;
+        _next = v;
+        return v;
+    }
+    
+    /// @brief Удалить текущую вершину
+    Vertex* remove() {
+        if (_prev) _prev->_next = _next;
+        if (_next) _next->_prev = _prev;
+        _next = _prev = nullptr;
+        return this;
+    }
+};
+
+/// @class Polygon
+/// @brief Класс для представления многоугольника
+class Polygon {
+public:
+    Vertex* _v; ///< Текущая вершина (окно)
+    int _size;  ///< Количество вершин
+    
+    /// @brief Основной конструктор
+    Polygon() : _v(nullptr), _size(0) {}
+    
+    /// @brief Конструктор копирования
+    /// @param other Исходный многоугольник
+    Polygon(const Polygon& other) : _v(nullptr), _size(0) {
+        if (other._v) {
+            Vertex* current = other._v;
+            do {
+                insert(*current);
+                current = current->cw();
+            } while (current != other._v);
+        }
+    }
+    
+    /// @brief Деструктор
+    ~Polygon() {
+        if (_v) {
+            Vertex* w = _v->cw();
+            while (w != _v) {
+                delete w->remove();
+                w = _v->cw();
+            }
+            delete _v;
+        }
+    }
+    
+    /// @brief Получить текущее ребро
+    /// @throws std::runtime_error если многоугольник пуст
+    Edge edge() {
+        if (!_v) throw std::runtime_error("Polygon is empty");
+        return Edge(*_v, *_v->cw());
+    }
+    
+    /// @brief Добавить вершину в многоугольник
+    /// @param p Точка для добавления
+    void insert(const Point& p) {
+        Vertex* v = new Vertex(p);
+        if (!_v) {
+            _v = v;
+            _v->_next = _v->_prev = _v;
+        } else _v->insert(v);
+        _size++;
+    }
+    
+    /// @brief Получить текущую точку
+    Point getPoint() const { return *_v; }
+    
+    /// @brief Переместить текущую вершину
+    /// @param rotation Направление перемещения
+    void advance(int rotation) { _v = _v->neighbor(rotation); }
+    
+    /// @brief Получить количество вершин
+    int size() const { return _size; }
+    
+    /// @brief Получить следующую вершину
+    Vertex* cw() { return _v->cw(); }
+};
+
+/// @brief Отсечение многоугольника одним ребром
+/// @param s Исходный многоугольник
+/// @param e Ребро отсечения
+/// @param result Результат отсечения
+/// @return true если результат не пуст
+inline bool clipPolygonToEdge(Polygon& s, Edge& e, Polygon*& result) {
+    Polygon* p = new Polygon();
+    for (int i = 0; i < s.size(); s.advance(CLOCKWISE), i++) {
+        Point org = s.getPoint(), dest = *s.cw();
+        bool orgInside = (org.classify(e) != LEFT), destInside = (dest.classify(e) != LEFT);
+        if (orgInside != destInside) {
+            double t = 0;
+            e.intersect(s.edge(), t);
+            Point cross = e.point(t);
+            if (orgInside) p->insert(cross);
+            else { p->insert(cross); p->insert(dest); }
+        } else if (orgInside) p->insert(dest);
+    }
+    result = p;
+    return p->size() > 0;
+}
+
+/// @struct HalfPlane
+/// @brief Линейное ограничение a*x + b*y <= c
+struct HalfPlane {
+    double a, b, c; ///< Коэффициенты ограничения
+};
+
+/// @class ClipPlan
+/// @brief Подготовленный отсекающий многоугольник
+///
+/// clipPolygonToEdge считает внутренними точки, не лежащие слева от ребра, то есть
+/// ожидает обход отсекателя по часовой стрелке. План один раз вычисляет ориентированную
+/// площадь отсекателя и при обратном обходе разворачивает рёбра, запоминая это в reversed.
+class ClipPlan {
+public:
+    std::vector<Point> vertices; ///< Вершины отсекателя в исходном порядке обхода
+    std::vector<Edge> edges;     ///< Рёбра, нормализованные по часовой стрелке
+    std::vector<double> a, b, c; ///< Коэффициенты рёбер: точка внутри, если a*x + b*y + c <= 0
+    double area;                 ///< Ориентированная площадь исходного обхода (> 0 — против часовой)
+    bool reversed;               ///< Обход был развёрнут при нормализации
+
+    /// @brief Построить план по отсекающему многоугольнику
+    /// @param p Отсекающий многоугольник
+    explicit ClipPlan(Polygon& p) : area(0), reversed(false) {
+        for (int i = 0; i < p.size(); p.advance(CLOCKWISE), i++)
+            vertices.push_back(p.getPoint());
+        build();
+    }
+
+    /// @brief Построить план по вершинам в порядке обхода
+    /// @param points Вершины отсекателя
+    explicit ClipPlan(const std::vector<Point>& points) : vertices(points), area(0), reversed(false) {
+        build();
+    }
+
+    /// @brief Построить план прямо по линейным ограничениям
+    /// @param constraints Ограничения a*x + b*y <= c
+    ///
+    /// Коэффициенты рёбер берутся из ограничений без пересчёта через вершины;
+    /// избыточные ограничения отбрасываются. Пустое пересечение даёт непригодный план,
+    /// а при отсутствии ограничивающих рёбер (в том числе без ограничений) план пригоден
+    /// и пропускает многоугольник без изменений.
+    explicit ClipPlan(const std::vector<HalfPlane>& constraints);
+
+    /// @brief План пригоден для отсечения (ненулевая площадь)
+    ///
+    /// У плана по многоугольнику ненулевая площадь означает хотя бы три ребра; план
+    /// по ограничениям может быть без рёбер — это тождественное отсечение.
+    bool valid() const { return area != 0; }
+
+    /// @brief Число рёбер плана
+    size_t size() const { return edges.size(); }
+
+private:
+    /// @brief Вычислить площадь, нормализовать рёбра и их коэффициенты
+    void build() {
+        size_t n = vertices.size();
+        for (size_t i = 0; i < n; ++i) {
+            const Point& p = vertices[i];
+            const Point& q = vertices[(i + 1) % n];
+            area += p.x * q.y - q.x * p.y;
+        }
+        area /= 2;
+        reversed = area > 0;
+        for (size_t i = 0; i < n; ++i) {
+            const Point& p = vertices[i];
+            const Point& q = vertices[(i + 1) % n];
+            Edge e = reversed ? Edge(q, p) : Edge(p, q);
+            // Знак совпадает с Point::classify: LEFT <=> a*x + b*y + c > 0
+            Point d = e.dest - e.org;
+            a.push_back(-d.y);
+            b.push_back(d.x);
+            c.push_back(d.y * e.org.x - d.x * e.org.y);
+            edges.push_back(e);
+        }
+    }
+};
+
+/// @brief Пересечение полуплоскостей за O(n log n)
+/// @param constraints Ограничения a*x + b*y <= c
+/// @param[out] active Индексы ограничений на границе области против часовой стрелки;
+///                    индексы от constraints.size() и выше — стороны ограничивающего квадрата
+/// @param[out] vertices Вершины области: vertices[i] — пересечение active[i] и active[i + 1]
+/// @return false если пересечение пусто или вырождено
+///
+/// Ограничения сортируются по углу направляющей, затем граница собирается в деке.
+/// Неограниченная область замыкается квадратом со стороной 2 * HALFPLANE_BOUND.
+inline bool intersectHalfPlanes(const std::vector<HalfPlane>& constraints, std::vector<int>& active, std::vector<Point>& vertices) {
+    // Направленная прямая: область слева от направления d, проходящего через p
+    struct Line {
+        Point p, d;
+        double angle;
+        int index;
+        bool out(const Point& v) const { return d.x * (v.y - p.y) - d.y * (v.x - p.x) < -HALFPLANE_EPSILON; }
+    };
+    auto intersection = [](const Line& s, const Line& t) {
+        double alpha = ((t.p.x - s.p.x) * t.d.y - (t.p.y - s.p.y) * t.d.x) / (s.d.x * t.d.y - s.d.y * t.d.x);
+        return Point(s.p.x + s.d.x * alpha, s.p.y + s.d.y * alpha);
+    };
+
+    std::vector<HalfPlane> all(constraints);
+    all.push_back({1, 0, HALFPLANE_BOUND});
+    all.push_back({0, 1, HALFPLANE_BOUND});
+    all.push_back({-1, 0, HALFPLANE_BOUND});
+    all.push_back({0, -1, HALFPLANE_BOUND});
+    std::vector<Line> lines;
+    for (size_t i = 0; i < all.size(); ++i) {
+        const HalfPlane& h = all[i];
+        double norm2 = h.a * h.a + h.b * h.b;
+        if (norm2 == 0) {
+            if (h.c < 0) return false;
+            continue;
+        }
+        double norm = std::sqrt(norm2);
+        Point d(-h.b / norm, h.a / norm);
+        lines.push_back({Point(h.a * h.c / norm2, h.b * h.c / norm2), d, std::atan2(d.y, d.x), (int)i});
+    }
+    std::sort(lines.begin(), lines.end(), [](const Line& s, const Line& t) { return s.angle < t.angle; });
+
+    std::deque<Line> dq;
+    for (const Line& line : lines) {
+        while (dq.size() > 1 && line.out(intersection(dq[dq.size() - 1], dq[dq.size() - 2]))) dq.pop_back();
+        while (dq.size() > 1 && line.out(intersection(dq[0], dq[1]))) dq.pop_front();
+        if (!dq.empty() && std::abs(line.d.x * dq.back().d.y - line.d.y * dq.back().d.x) < HALFPLANE_EPSILON) {
+            if (line.d.x * dq.back().d.x + line.d.y * dq.back().d.y < 0) return false;
+            if (line.out(dq.back().p)) dq.back() = line;
+            continue;
+        }
+        dq.push_back(line);
+    }
+    while (dq.size() > 2 && dq[0].out(intersection(dq[dq.size() - 1], dq[dq.size() - 2]))) dq.pop_back();
+    while (dq.size() > 2 && dq[dq.size() - 1].out(intersection(dq[0], dq[1]))) dq.pop_front();
+    if (dq.size() < 3) return false;
+
+    active.clear();
+    vertices.clear();
+    for (size_t i = 0; i < dq.size(); ++i) {
+        active.push_back(dq[i].index);
+        vertices.push_back(intersection(dq[i], dq[(i + 1) % dq.size()]));
+    }
+    return true;
+}
+
+inline ClipPlan::ClipPlan(const std::vector<HalfPlane>& constraints) : area(0), reversed(false) {
+    std::vector<int> active;
+    std::vector<Point> ccw;
+    if (!intersectHalfPlanes(constraints, active, ccw)) return;
+    size_t m = ccw.size();
+    for (size_t i = 0; i < m; ++i) area += ccw[i].x * ccw[(i + 1) % m].y - ccw[(i + 1) % m].x * ccw[i].y;
+    if (area <= 0) {
+        area = 0;
+        return;
+    }
+    // План хранит обход по часовой стрелке: граница active[i] идёт от вершины i к вершине i - 1
+    area = -area / 2;
+    vertices.assign(ccw.rbegin(), ccw.rend());
+    for (size_t k = m; k-- > 0;) {
+        if (active[k] >= (int)constraints.size()) continue;
+        const HalfPlane& h = constraints[active[k]];
+        edges.push_back(Edge(ccw[k], ccw[(k + m - 1) % m]));
+        a.push_back(h.a);
+        b.push_back(h.b);
+        c.push_back(-h.c);
+    }
+}
+
+/// @brief Отсечение выпуклым планом с выдачей вершин последнего этапа прямо в приёмник
+/// @tparam Plan ClipPlan или FixedClipPlan: size(), valid() и коэффициенты a, b, c
+/// @tparam Sink Тип с методом emit(const Point&)
+/// @param subject Вершины исходного многоугольника
+/// @param plan Нормализованный план выпуклого отсекателя
+/// @param sink Приёмник вершин результата
+/// @return true если результат не пуст
+///
+/// На каждом ребре сначала одним проходом считаются расстояния до всех вершин
+/// (цикл без ветвлений, векторизуется компилятором), затем формируется выход.
+/// Последний этап не собирает промежуточный массив, а сразу отдаёт вершины приёмнику,
+/// например кодировщику выходного формата.
+template <class Plan, class Sink>
+bool clipConvexInto(const std::vector<Point>& subject, const Plan& plan, Sink& sink) {
+    if (!plan.valid() || subject.empty()) return false;
+    if (plan.size() == 0) {
+        for (const Point& v : subject) sink.emit(v);
+        return true;
+    }
+    const std::vector<Point>* in = &subject;
+    std::vector<Point> buffers[2];
+    std::vector<double> dist;
+    for (size_t k = 0; k < plan.size(); ++k) {
+        const std::vector<Point>& src = *in;
+        size_t n = src.size();
+        double a = plan.a[k], b = plan.b[k], c = plan.c[k];
+        dist.resize(n);
+        for (size_t i = 0; i < n; ++i) dist[i] = a * src[i].x + b * src[i].y + c;
+        size_t emitted = 0;
+        auto stage = [&](auto&& put) {
+            for (size_t i = 0; i < n; ++i) {
+                size_t j = (i + 1 == n) ? 0 : i + 1;
+                bool orgInside = dist[i] <= 0, destInside = dist[j] <= 0;
+                if (orgInside != destInside) {
+                    double t = dist[i] / (dist[i] - dist[j]);
+                    put(Point(src[i].x + t * (src[j].x - src[i].x), src[i].y + t * (src[j].y - src[i].y)));
+                }
+                if (destInside) put(src[j]);
+            }
+        };
+        if (k + 1 == plan.size()) {
+            stage([&](const Point& v) { sink.emit(v); ++emitted; });
+            return emitted > 0;
+        }
+        std::vector<Point>& out = buffers[k & 1];
+        out.clear();
+        stage([&](const Point& v) { out.push_back(v); });
+        if (out.empty()) return false;
+        in = &out;
+    }
+    return false;
+}
+
+/// @brief Отсечение выпуклым планом на непрерывных массивах вершин
+/// @tparam Plan ClipPlan или FixedClipPlan: size(), valid() и коэффициенты a, b, c
+/// @param subject Вершины исходного многоугольника
+/// @param plan Нормализованный план выпуклого отсекателя
+/// @param result Вершины результата
+/// @return true если результат не пуст
+template <class Plan>
+bool clipConvex(const std::vector<Point>& subject, const Plan& plan, std::vector<Point>& result) {
+    struct VectorSink {
+        std::vector<Point>& out;
+        void emit(const Point& v) { out.push_back(v); }
+    } sink{result};
+    result.clear();
+    return clipConvexInto(subject, plan, sink);
+}
+
+/// @class FixedClipPlan
+/// @brief План выпуклого отсекателя с числом вершин, известным при компиляции
+/// @tparam N Число вершин
+///
+/// Строится constexpr: для окон, заданных в коде (границы экрана, тайла, зоны датчика),
+/// ориентация, ограничивающий прямоугольник и коэффициенты рёбер вычисляются при
+/// компиляции, а clipConvex с таким планом получает константы прямо в цикл.
+template <size_t N>
+class FixedClipPlan {
+public:
+    double a[N], b[N], c[N]; ///< Коэффициенты рёбер: точка внутри, если a*x + b*y + c <= 0
+    double area;             ///< Ориентированная площадь исходного обхода (> 0 — против часовой)
+    bool reversed;           ///< Обход был развёрнут при нормализации
+    BBox box;                ///< Ограничивающий прямоугольник окна
+
+    /// @brief Построить план по вершинам в порядке обхода
+    /// @param points Вершины отсекателя
+    constexpr explicit FixedClipPlan(const Point (&points)[N])
+        : a{}, b{}, c{}, area(signedArea(points, N)), reversed(area > 0), box(boundingBox(points, N)) {
+        for (size_t i = 0; i < N; ++i) {
+            const Point& p = points[i];
+            const Point& q = points[(i + 1) % N];
+            Edge e = reversed ? Edge(q, p) : Edge(p, q);
+            Point d = e.dest - e.org;
+            a[i] = -d.y;
+            b[i] = d.x;
+            c[i] = d.y * e.org.x - d.x * e.org.y;
+        }
+    }
+
+    /// @brief План пригоден для отсечения (ненулевая площадь)
+    constexpr bool valid() const { return N >= 3 && area != 0; }
+
+    /// @brief Число рёбер плана
+    static constexpr size_t size() { return N; }
+
+    /// @brief Точка внутри окна или на его границе
+    constexpr bool contains(const Point& v) const {
+        for (size_t i = 0; i < N; ++i)
+            if (a[i] * v.x + b[i] * v.y + c[i] > 0) return false;
+        return true;
+    }
+};
+
+/// @brief Построить план при компиляции: constexpr auto plan = makeClipPlan({Point(0, 0), ...});
+template <size_t N>
+constexpr FixedClipPlan<N> makeClipPlan(const Point (&points)[N]) { return FixedClipPlan<N>(points); }
+
+// Проверка, что план действительно строится при компиляции
+static_assert(makeClipPlan({Point(0, 0), Point(1, 0), Point(1, 1), Point(0, 1)}).reversed,
+              "counter-clockwise window must be normalized");
+static_assert(makeClipPlan({Point(0, 0), Point(1, 0), Point(1, 1), Point(0, 1)}).contains(Point(0.5, 0.5)),
+              "window center must be inside");
+
+/// @brief Отсечение многоугольника по готовому плану
+/// @param s Исходный многоугольник
+/// @param plan Нормализованный план отсекателя
+/// @param result Результат отсечения
+/// @return true если результат не пуст
+inline bool clipPolygon(Polygon& s, const ClipPlan& plan, Polygon*& result) {
+    if (!plan.valid()) return false;
+    Polygon* q = new Polygon(s);
+    for (Edge e : plan.edges) {
+        Polygon* r;
+        bool nonEmpty = clipPolygonToEdge(*q, e, r);
+        delete q;
+        q = r;
+        if (!nonEmpty) {
+            delete q;
+            return false;
+        }
+    }
+    result = q;
+    return true;
+}
+
+/// @brief Основная функция отсечения
+/// @param s Исходный многоугольник
+/// @param p Отсекающий многоугольник (любая ориентация обхода)
+/// @param result Результат отсечения
+/// @return true если отсечение прошло успешно
+inline bool clipPolygon(Polygon& s, Polygon& p, Polygon*& result) {
+    ClipPlan plan(p);
+    return clipPolygon(s, plan, result);
+}
@@ -1,321 +1,4052 @@
-/// @file server.cpp
-/// @brief Серверная часть алгоритма отсечения Сазерленда-Ходжмана
-
-#include <iostream>
-#include <stdexcept>
-#include <cmath>
-#include <sstream>
-#include <vector>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <unistd.h>
-#include <arpa/inet.h>
-
-/// @enum PointClass
-/// @brief Классификация положения точки относительно ребра
-enum PointClass { LEFT, RIGHT, BEHIND, BEYOND, BETWEEN, ORIGIN, DESTINATION };
-
-/// @enum Rotation
-/// @brief Направление обхода вершин
-enum Rotation { CLOCKWISE, COUNTER_CLOCKWISE };
-
-class Edge;
-
-/// @class Point
-/// @brief Класс для представления точки в 2D пространстве
-class Point {
-public:
-    double x, y; ///< Координаты точки
-    
-    /// @brief Конструктор точки
-    /// @param x Координата X (по умолчанию 0)
-    /// @param y Координата Y (по умолчанию 0)
-    Point(double x = 0, double y = 0) : x(x), y(y) {}
-    
-    /// @brief Оператор сравнения точек
-    bool operator==(const Point& other) const {
-        return (x - other.x)*(x - other.x) + (y - other.y)*(y - other.y) < 1e-15;
-    }
-    
-    /// @brief Оператор неравенства точек
-    bool operator!=(const Point& other) const { return !(*this == other); }
-    
-    /// @brief Вычитание точек (векторная операция)
-    Point operator-(const Point& other) const { return Point(x - other.x, y - other.y); }
-    
-    /// @brief Длина вектора от начала координат
-    double length() const { return std::sqrt(x * x + y * y); }
-    
-    /// @brief Классификация точки относительно ребра
-    /// @param e Ребро для классификации
-    PointClass classify(const Edge& e) const;
-};
-
-/// @class Edge
-/// @brief Класс для представления ребра многоугольника
-class Edge {
-public:
-    Point org; ///< Начальная точка ребра
-    Point dest; ///< Конечная точка ребра
-    
-    /// @brief Конструктор ребра
-    /// @param org Начальная точка
-    /// @param dest Конечная точка
-    Edge(const Point& org, const Point& dest) : org(org), dest(dest) {}
-    
-    /// @brief Получить точку на ребре по параметру t
-    /// @param t Параметр от 0 до 1
-    Point point(double t) const { 
-        return Point(org.x + t*(dest.x - org.x), org.y + t*(dest.y - org.y)); 
-    }
-    
-    /// @brief Поиск пересечения с другим ребром
-    /// @param e Ребро для проверки пересечения
-    /// @param[out] t Параметр точки пересечения
-    /// @return true если пересечение существует
-    bool intersect(const Edge& e, double& t) const;
-};
-
-// Реализация методов класса Point
-PointClass Point::classify(const Edge& e) const {
-    Point a = e.dest - e.org;
-    Point b = *this - e.org;
-    double sa = a.x * b.y - b.x * a.y;
-    if (sa > 0.0) return LEFT;
-    if (sa < 0.0) return RIGHT;
-    if ((a.x * b.x < 0.0) || (a.y * b.y < 0.0)) return BEHIND;
-    if (a.length() < b.length()) return BEYOND;
-    if (e.org == *this) return ORIGIN;
-    if (e.dest == *this) return DESTINATION;
-    return BETWEEN;
-}
-
-// Реализация методов класса Edge
-bool Edge::intersect(const Edge& e, double& t) const {
-    double a = dest.x - org.x, b = e.org.x - e.dest.x;
-    double c = dest.y - org.y, d = e.org.y - e.dest.y;
-    double denom = a * d - b * c;
-    if (std::abs(denom) < 1e-15) return false;
-    double e1 = e.org.x - org.x, e2 = e.org.y - org.y;
-    t = (e1 * d - e2 * b) / denom;
-    double u = (e1 * c - e2 * a) / denom;
-    return t >= 0 && t <= 1 && u >= 0 && u <= 1;
-}
-
-/// @class Vertex
-/// @brief Вершина многоугольника с указателями на соседей
-class Vertex : public Point {
-public:
-    Vertex* _next; ///< Следующая вершина (по часовой стрелке)
-    Vertex* _prev; ///< Предыдущая вершина (против часовой стрелки)
-    
-    /// @brief Основной конструктор
-    /// @param x Координата X
-    /// @param y Координата Y
-    Vertex(double x = 0, double y = 0) : Point(x, y), _next(nullptr), _prev(nullptr) {}
-    
-    /// @brief Конструктор из точки
-    /// @param p Исходная точка
-    Vertex(const Point& p) : Point(p), _next(nullptr), _prev(nullptr) {}
-    
-    /// @brief Получить следующую вершину
-    Vertex* cw() { return _next; }
-    
-    /// @brief Получить предыдущую вершину
-    Vertex* ccw() { return _prev; }
-    
-    /// @brief Получить соседа по направлению
-    /// @param rotation Направление (CLOCKWISE/COUNTER_CLOCKWISE)
-    Vertex* neighbor(int rotation) { return (rotation == CLOCKWISE) ? cw() : ccw(); }
-    
-    /// @brief Вставить вершину после текущей
-    /// @param v Вершина для вставки
-    Vertex* insert(Vertex* v) {
-        v->_next = _next;
-        v->_prev = this;
-        if (_next) _next->_prev = v;
-        _next = v;
-        return v;
-    }
-    
-    /// @brief Удалить текущую вершину
-    Vertex* remove() {
-        if (_prev) _prev->_next = _next;
-        if (_next) _next->_prev = _prev;
-        _next = _prev = nullptr;
-        return this;
-    }
-};
-
-/// @class Polygon
-/// @brief Класс для представления многоугольника
-class Polygon {
-public:
-    Vertex* _v; ///< Текущая вершина (окно)
-    int _size;  ///< Количество вершин
-    
-    /// @brief Основной конструктор
-    Polygon() : _v(nullptr), _size(0) {}
-    
-    /// @brief Конструктор копирования
-    /// @param other Исходный многоугольник
-    Polygon(const Polygon& other) : _v(nullptr), _size(0) {
-        if (other._v) {
-            Vertex* current = other._v;
-            do {
-                insert(*current);
-                current = current->cw();
-            } while (current != other._v);
-        }
-    }
-    
-    /// @brief Деструктор
-    ~Polygon() {
-        if (_v) {
-            Vertex* w = _v->cw();
-            while (w != _v) {
-                delete w->remove();
-                w = _v->cw();
-            }
-            delete _v;
-        }
-    }
-    
-    /// @brief Получить текущее ребро
-    /// @throws std::runtime_error если многоугольник пуст
-    Edge edge() {
-        if (!_v) throw std::runtime_error("Polygon is empty");
-        return Edge(*_v, *_v->cw());
-    }
-    
-    /// @brief Добавить вершину в многоугольник
-    /// @param p Точка для добавления
-    void insert(const Point& p) {
-        Vertex* v = new Vertex(p);
-        if (!_v) {
-            _v = v;
-            _v->_next = _v->_prev = _v;
-        } else _v->insert(v);
-        _size++;
-    }
-    
-    /// @brief Получить текущую точку
-    Point getPoint() const { return *_v; }
-    
-    /// @brief Переместить текущую вершину
-    /// @param rotation Направление перемещения
-    void advance(int rotation) { _v = _v->neighbor(rotation); }
-    
-    /// @brief Получить количество вершин
-    int size() const { return _size; }
-    
-    /// @brief Получить следующую вершину
-    Vertex* cw() { return _v->cw(); }
-};
-
-/// @brief Отсечение многоугольника одним ребром
-/// @param s Исходный многоугольник
-/// @param e Ребро отсечения
-/// @param result Результат отсечения
-/// @return true если результат не пуст
-bool clipPolygonToEdge(Polygon& s, Edge& e, Polygon*& result) {
-    Polygon* p = new Polygon();
-    for (int i = 0; i < s.size(); s.advance(CLOCKWISE), i++) {
-        Point org = s.getPoint(), dest = *s.cw();
-        bool orgInside = (org.classify(e) != LEFT), destInside = (dest.classify(e) != LEFT);
-        if (orgInside != destInside) {
-            double t;
-            e.intersect(s.edge(), t);
-            Point cross = e.point(t);
-            if (orgInside) p->insert(cross);
-            else { p->insert(cross); p->insert(dest); }
-        } else if (orgInside) p->insert(dest);
-    }
-    result = p;
-    return p->size() > 0;
-}
-
-/// @brief Основная функция отсечения
-/// @param s Исходный многоугольник
-/// @param p Отсекающий многоугольник
-/// @param result Результат отсечения
-/// @return true если отсечение прошло успешно
-bool clipPolygon(Polygon& s, Polygon& p, Polygon*& result) {
-    Polygon* q = new Polygon(s);
-    for (int i = 0; i < p.size(); p.advance(CLOCKWISE), i++) {
-        Edge e = p.edge();
-        Polygon* r;
-        if (!clipPolygonToEdge(*q, e, r)) {
-            delete q;
-            return false;
-        }
-        delete q;
-        q = r;
-    }
-    result = q;
-    return true;
-}
-
-/// @brief Основная функция сервера
-int main() {
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    sockaddr_in address{AF_INET, htons(8080), INADDR_ANY};
-    bind(server_fd, (sockaddr*)&address, sizeof(address));
-    listen(server_fd, 3);
-    std::cout << "Server listening on port 8080..." << std::endl;
-
-    while (true) {
-        sockaddr_in client_addr;
-        socklen_t addr_len = sizeof(client_addr);
-        int client_sock = accept(server_fd, (sockaddr*)&client_addr, &addr_len);
-        std::cout << "Client connected" << std::endl;
-        
-        std::string data;
-        char buffer[1024];
-        ssize_t bytes_read;
-        while ((bytes_read = recv(client_sock, buffer, sizeof(buffer), 0))) {
-            data.append(buffer, bytes_read);
-            if (bytes_read < sizeof(buffer)) break;
-        }
-
-        std::istringstream iss(data);
-        try {
-            int s_size, p_size;
-            iss >> s_size;
-            Polygon s;
-            for (int i = 0; i < s_size; ++i) {
-                double x, y;
-                iss >> x >> y;
-                s.insert(Point(x, y));
-            }
-            iss >> p_size;
-            Polygon p;
-            for (int i = 0; i < p_size; ++i) {
-                double x, y;
-                iss >> x >> y;
-                p.insert(Point(x, y));
-            }
-            
-            Polygon* result = nullptr;
-            std::ostringstream response;
-            if (clipPolygon(s, p, result)) {
-                response << "OK\n" << result->size() << "\n";
-                Vertex* v = result->_v;
-                do {
-                    response << v->x << " " << v->y << "\n";
-                    v = v->cw();
-                } while (v != result->_v);
-                delete result;
-            } else {
-                response << "FAIL\n";
-            }
-            
-            std::string res_str = response.str();
-            send(client_sock, res_str.c_str(), res_str.size(), 0);
-        } catch (...) {
-            send(client_sock, "ERROR\n", 6, 0);
-        }
-        close(client_sock);
-    }
-    return 0;
-}
\ No newline at end of file
+/// @file server.cpp
+/// @brief Серверная часть алгоритма отсечения Сазерленда-Ходжмана
+
+#include <iostream>
+#include <stdexcept>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <sstream>
+#include <fstream>
+#include <vector>
+#include <array>
+#include <deque>
+#include <list>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <chrono>
+#include <functional>
+#include <numeric>
+#include <unordered_map>
+#include <thread>
+#include <climits>
+#include <charconv>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <execinfo.h>
+#include <arpa/inet.h>
+#include "geometry.h"
+#include "transport.h"
+
+/// @brief Число планов отсекателей в кеше сервера
+constexpr size_t PLAN_CACHE_CAPACITY = 1024;
+/// @brief Относительный шаг сетки при склейке результатов выпуклых частей
+constexpr double MERGE_EPSILON = 1e-9;
+/// @brief Минимум "вершин субъекта x частей окна" для параллельного отсечения
+constexpr size_t PARALLEL_MIN_WORK = 4096;
+/// @brief Разрешение тайла пирамиды: допуск упрощения уровня — один пиксель
+constexpr double PYRAMID_TILE_PIXELS = 256;
+/// @brief Наибольший уровень пирамиды
+constexpr int PYRAMID_MAX_ZOOM = 24;
+/// @brief Наибольшее число тайлов, обрабатываемых одним заданием
+constexpr size_t PYRAMID_MAX_TILES = 1 << 18;
+/// @brief Наибольший размер векторного тайла в целочисленных единицах
+constexpr uint32_t TILE_MAX_EXTENT = 1u << 24;
+/// @brief Наибольшее число пикселей маски покрытия
+constexpr size_t COVERAGE_MAX_PIXELS = 1 << 24;
+/// @brief Наибольший размер документа GeoJSON в одном запросе
+constexpr size_t GEOJSON_MAX_BYTES = 1u << 30;
+/// @brief Вес нового замера в скользящем среднем задержки планировщика
+constexpr double LOAD_EWMA_WEIGHT = 0.1;
+/// @brief Период проверок сторожевого потока, мс (он же таймаут цикла приёма соединений)
+constexpr int WATCHDOG_INTERVAL_MS = 100;
+/// @brief Задание дольше этого считается зависшим, мс
+constexpr int64_t WATCHDOG_STALL_MS = 2000;
+/// @brief Задержка итерации цикла приёма, после которой он считается зависшим, мс
+constexpr int64_t WATCHDOG_LOOP_LAG_MS = 500;
+/// @brief Сколько байт запроса сохраняется для журнала зависаний
+constexpr size_t WATCHDOG_CAPTURE_BYTES = 4096;
+/// @brief Наибольшее число вычислительных потоков планировщика
+constexpr unsigned SCHEDULER_MAX_WORKERS = 256;
+/// @brief Наибольшее число заданий в одном пакете планировщика
+constexpr size_t SCHEDULER_MAX_BATCH = 64;
+/// @brief Наибольшее число атрибутов вершины в запросе FRUSTUM
+constexpr int FRUSTUM_MAX_ATTRS = 64;
+/// @brief Наибольшее число ограничений в запросе HALFPLANES
+constexpr int HALFPLANES_MAX = 1 << 20;
+/// @brief Наибольшее число арендаторов
+constexpr size_t TENANT_MAX = 256;
+/// @brief Наибольшее число потомков узла R-дерева
+constexpr size_t RTREE_NODE_CAPACITY = 16;
+/// @brief Порядок кривой Гильберта: бит на координату ключа
+constexpr int HILBERT_ORDER = 16;
+/// @brief Сколько новых окон копится до внеочередной перестройки индекса окон
+constexpr size_t WINDOW_INDEX_MIN_PENDING = 64;
+/// @brief Пауза, после которой индекс окон перестраивается при любом числе новых окон, мс
+constexpr int WINDOW_INDEX_DELAY_MS = 1000;
+/// @brief Наибольшая сторона сетки зон для поиска точек, ячеек
+constexpr size_t ZONE_GRID_MAX_SIDE = 1024;
+/// @brief Наибольшее число ячеек сетки зон под одним прямоугольником; большие идут в R-дерево
+constexpr size_t ZONE_GRID_MAX_CELLS = 16;
+/// @brief Наибольшее число точек в запросе POINTS
+constexpr size_t POINTS_MAX_BATCH = 1 << 20;
+/// @brief Точек в одной части пакета POINTS при параллельной обработке
+constexpr size_t POINTS_CHUNK = 4096;
+/// @brief Наибольшая длина имени арендатора
+constexpr size_t TENANT_NAME_MAX = 64;
+/// @brief Период решений подстройки числа потоков, мс
+constexpr int TUNER_INTERVAL_MS = 1000;
+/// @brief Сколько периодов подряд должен держаться сигнал, чтобы число потоков изменилось
+constexpr int TUNER_HYSTERESIS = 3;
+/// @brief Ожидание в очереди, при котором не хватает потоков, мс
+constexpr double TUNER_GROW_WAIT_MS = 2;
+/// @brief Доля занятости потоков, выше которой они считаются насыщенными
+constexpr double TUNER_BUSY_HIGH = 0.8;
+/// @brief Доля занятости потоков, ниже которой их слишком много
+constexpr double TUNER_BUSY_LOW = 0.3;
+/// @brief Доля процессорного времени сервера в занятости потоков, ниже которой им не хватает ядер
+constexpr double TUNER_CPU_STARVED = 0.5;
+/// @brief Доля простоя ядер узла, ниже которой узел считается занятым
+constexpr double TUNER_HOST_SATURATED = 0.05;
+/// @brief Сколько периодов не расти после отката неудачного роста
+constexpr int TUNER_COOLDOWN = 10;
+/// @brief Наибольшая глубина снимка стека зависшего потока
+constexpr int WATCHDOG_STACK_DEPTH = 64;
+
+/// @brief Монотонное время в наносекундах
+inline int64_t steadyNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// @class Histogram
+/// @brief Гистограмма неотрицательных значений по степеням двойки, без блокировок
+class Histogram {
+public:
+    /// @brief Добавить значение
+    void record(uint64_t v) {
+        _buckets[v ? 64 - __builtin_clzll(v) : 0].fetch_add(1, std::memory_order_relaxed);
+        _count.fetch_add(1, std::memory_order_relaxed);
+        _sum.fetch_add(v, std::memory_order_relaxed);
+        uint64_t max = _max.load(std::memory_order_relaxed);
+        while (v > max && !_max.compare_exchange_weak(max, v, std::memory_order_relaxed)) {}
+    }
+
+    /// @brief Число значений
+    uint64_t count() const { return _count.load(std::memory_order_relaxed); }
+    /// @brief Сумма значений
+    uint64_t sum() const { return _sum.load(std::memory_order_relaxed); }
+    /// @brief Наибольшее значение
+    uint64_t max() const { return _max.load(std::memory_order_relaxed); }
+
+    /// @brief Квантиль q: верхняя граница корзины, в которую он попал
+    uint64_t quantile(double q) const {
+        uint64_t total = count(), seen = 0;
+        for (int b = 0; b < BUCKETS; ++b) {
+            seen += _buckets[b].load(std::memory_order_relaxed);
+            if (total && seen >= q * total) return std::min(b ? (uint64_t(1) << b) - 1 : 0, max());
+        }
+        return max();
+    }
+
+private:
+    static constexpr int BUCKETS = 65;        ///< Корзина b: значения [2^(b-1), 2^b)
+    std::atomic<uint64_t> _buckets[BUCKETS]{}; ///< Счётчики корзин
+    std::atomic<uint64_t> _count{0};           ///< Число значений
+    std::atomic<uint64_t> _sum{0};             ///< Сумма значений
+    std::atomic<uint64_t> _max{0};             ///< Наибольшее значение
+};
+
+/// @class Metrics
+/// @brief Реестр именованных показателей сервера: целочисленные счётчики и гистограммы
+///
+/// Показатель создаётся при первом обращении и живёт до конца работы, поэтому ссылку
+/// удобно запомнить в статической переменной: static auto& c = metrics.counter("...").
+/// Обновления — атомарные операции без блокировок.
+class Metrics {
+public:
+    /// @brief Показатель по имени (создаётся с нулём)
+    std::atomic<int64_t>& counter(const std::string& name) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _values[name];
+    }
+
+    /// @brief Гистограмма по имени (создаётся пустой)
+    Histogram& histogram(const std::string& name) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _histograms[name];
+    }
+
+    /// @brief Записать все показатели: число и строки "имя значение"
+    ///
+    /// Гистограмма name даёт строки name.count, name.sum, name.p50, name.p99 и name.max.
+    void write(std::ostream& out) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        out << _values.size() + 5 * _histograms.size() << "\n";
+        for (const auto& v : _values) out << v.first << " " << v.second.load(std::memory_order_relaxed) << "\n";
+        for (const auto& h : _histograms) {
+            out << h.first << ".count " << h.second.count() << "\n" << h.first << ".sum " << h.second.sum() << "\n"
+                << h.first << ".p50 " << h.second.quantile(0.5) << "\n" << h.first << ".p99 "
+                << h.second.quantile(0.99) << "\n" << h.first << ".max " << h.second.max() << "\n";
+        }
+    }
+
+private:
+    std::map<std::string, std::atomic<int64_t>> _values; ///< Счётчики по именам (адреса стабильны)
+    std::map<std::string, Histogram> _histograms;        ///< Гистограммы по именам
+    std::mutex _mutex;                                   ///< Защита списков
+};
+
+/// @brief Показатели сервера
+Metrics metrics;
+
+#ifdef POLYGON_LOCK_STATS
+/// @class LockSite
+/// @brief Место захвата блокировки: гистограммы ожидания и удержания, нс
+///
+/// Создаётся один раз на место макросом LOCK и регистрирует гистограммы
+/// lock.<файл:строка>.wait_ns и lock.<файл:строка>.hold_ns.
+class LockSite {
+public:
+    explicit LockSite(const char* where)
+        : where(where), wait(metrics.histogram(std::string("lock.") + where + ".wait_ns")),
+          hold(metrics.histogram(std::string("lock.") + where + ".hold_ns")) {
+        std::lock_guard<std::mutex> lock(sitesMutex());
+        sites().push_back(this);
+    }
+
+    /// @brief Все места захвата, встреченные с начала работы
+    static std::vector<LockSite*> list() {
+        std::lock_guard<std::mutex> lock(sitesMutex());
+        return sites();
+    }
+
+    const char* where;            ///< "файл:строка"
+    Histogram& wait;              ///< Ожидание захвата
+    Histogram& hold;              ///< Удержание
+    std::atomic<uint64_t> contended{0}; ///< Захватов, не прошедших с первой попытки
+
+private:
+    static std::vector<LockSite*>& sites() {
+        static std::vector<LockSite*> all;
+        return all;
+    }
+    static std::mutex& sitesMutex() {
+        static std::mutex m;
+        return m;
+    }
+};
+
+/// @class SiteLock
+/// @brief Захват std::mutex с замером ожидания и удержания для места LockSite
+///
+/// Совместим с std::condition_variable_any: при ожидании условия удержание
+/// закрывается, а повторный захват снова замеряется.
+class SiteLock {
+public:
+    SiteLock(std::mutex& mutex, LockSite& site) : _mutex(mutex), _site(site), _owns(false) { lock(); }
+    ~SiteLock() {
+        if (_owns) unlock();
+    }
+    SiteLock(const SiteLock&) = delete;
+    SiteLock& operator=(const SiteLock&) = delete;
+
+    void lock() {
+        int64_t start = steadyNs();
+        if (!_mutex.try_lock()) {
+            ++_site.contended;
+            _mutex.lock();
+        }
+        _acquired = steadyNs();
+        _site.wait.record(_acquired - start);
+        _owns = true;
+    }
+
+    void unlock() {
+        _site.hold.record(steadyNs() - _acquired);
+        _owns = false;
+        _mutex.unlock();
+    }
+
+private:
+    std::mutex& _mutex; ///< Блокировка
+    LockSite& _site;    ///< Место захвата
+    int64_t _acquired;  ///< Время захвата, нс
+    bool _owns;         ///< Блокировка захвачена
+};
+
+#define LOCK_STRING(x) #x
+#define LOCK_SITE(file, line) file ":" LOCK_STRING(line)
+/// @brief Захватить m до конца области видимости под именем name
+#define LOCK(name, m) \
+    static LockSite name##Site(LOCK_SITE(__FILE__, __LINE__)); \
+    SiteLock name(m, name##Site)
+/// @brief Условная переменная, совместимая с LOCK
+typedef std::condition_variable_any ServerCondition;
+#else
+/// @brief Захватить m до конца области видимости под именем name
+///
+/// При сборке с -DPOLYGON_LOCK_STATS захват замеряется по месту "файл:строка".
+#define LOCK(name, m) std::unique_lock<std::mutex> name(m)
+/// @brief Условная переменная, совместимая с LOCK
+typedef std::condition_variable ServerCondition;
+#endif
+
+/// @class Plane4
+/// @brief Плоскость отсечения в однородных координатах: вершина внутри, если distance >= 0
+///
+/// Аналог Edge для отсечения усечённой пирамидой видимости до перспективного деления.
+class Plane4 {
+public:
+    double x, y, z, w; ///< Коэффициенты плоскости
+
+    /// @brief Конструктор плоскости
+    constexpr Plane4(double x, double y, double z, double w) : x(x), y(y), z(z), w(w) {}
+
+    /// @brief Ориентированное расстояние до вершины (x, y, z, w, ...)
+    double distance(const double* v) const { return x * v[0] + y * v[1] + z * v[2] + w * v[3]; }
+};
+
+/// @brief Шесть плоскостей пирамиды видимости: -w <= x, y, z <= w; бит i кода вершины — вне плоскости i
+constexpr Plane4 FRUSTUM_PLANES[6] = {
+    Plane4(1, 0, 0, 1), Plane4(-1, 0, 0, 1),
+    Plane4(0, 1, 0, 1), Plane4(0, -1, 0, 1),
+    Plane4(0, 0, 1, 1), Plane4(0, 0, -1, 1),
+};
+
+/// @brief Отсечение многоугольника одной плоскостью с интерполяцией атрибутов
+/// @param in Вершины подряд: x y z w и атрибуты, stride чисел на вершину
+/// @param stride Число чисел на вершину
+/// @param plane Плоскость отсечения
+/// @param out Вершины результата в том же формате
+/// @return true если результат не пуст
+///
+/// Точка пересечения интерполирует все компоненты вершины линейно в пространстве
+/// отсечения, что до перспективного деления даёт перспективно-корректные атрибуты.
+/// Пересечение добавляется, только если концы ребра строго по разные стороны плоскости:
+/// вершина на плоскости уже попадает в результат как внутренняя и не дублируется.
+bool clipPolygonToPlane(const std::vector<double>& in, size_t stride, const Plane4& plane, std::vector<double>& out) {
+    out.clear();
+    size_t n = in.size() / stride;
+    for (size_t i = 0; i < n; ++i) {
+        const double* org = &in[i * stride];
+        const double* dest = &in[((i + 1) % n) * stride];
+        double dOrg = plane.distance(org), dDest = plane.distance(dest);
+        if ((dOrg < 0 && dDest > 0) || (dOrg > 0 && dDest < 0)) {
+            double t = dOrg / (dOrg - dDest);
+            for (size_t k = 0; k < stride; ++k) out.push_back(org[k] + t * (dest[k] - org[k]));
+        }
+        if (dDest >= 0) out.insert(out.end(), dest, dest + stride);
+    }
+    return !out.empty();
+}
+
+/// @struct VertexBatch4
+/// @brief Пакет многоугольников в однородных координатах
+///
+/// Координаты хранятся по компонентам (SoA), чтобы классификация всех вершин пакета
+/// шла одним векторизуемым проходом; атрибуты — подряд по вершинам.
+struct VertexBatch4 {
+    size_t attrs = 0;              ///< Число атрибутов на вершину
+    std::vector<double> x, y, z, w; ///< Координаты вершин
+    std::vector<double> attr;      ///< Атрибуты вершин, attrs на вершину
+    std::vector<size_t> offsets{0}; ///< Начало каждого многоугольника; последний элемент — число вершин
+
+    /// @brief Число многоугольников
+    size_t polygons() const { return offsets.size() - 1; }
+
+    /// @brief Добавить вершину: x y z w и attrs атрибутов
+    void push(const double* v) {
+        x.push_back(v[0]);
+        y.push_back(v[1]);
+        z.push_back(v[2]);
+        w.push_back(v[3]);
+        attr.insert(attr.end(), v + 4, v + 4 + attrs);
+    }
+
+    /// @brief Завершить текущий многоугольник
+    void close() { offsets.push_back(x.size()); }
+};
+
+/// @brief Отсечь пакет многоугольников пирамидой видимости
+/// @param batch Исходный пакет
+/// @return Пакет результатов; i-й многоугольник соответствует i-му исходному (возможно, пустой)
+///
+/// Коды всех вершин вычисляются одним проходом без ветвлений. Многоугольники целиком
+/// вне одной плоскости отбрасываются, целиком внутри — копируются, остальные
+/// отсекаются только теми плоскостями, которые они пересекают.
+VertexBatch4 clipFrustum(const VertexBatch4& batch) {
+    size_t n = batch.x.size(), stride = 4 + batch.attrs;
+    std::vector<uint8_t> codes(n);
+    const double *x = batch.x.data(), *y = batch.y.data(), *z = batch.z.data(), *w = batch.w.data();
+    for (size_t i = 0; i < n; ++i) {
+        codes[i] = (uint8_t)((w[i] + x[i] < 0) | (w[i] - x[i] < 0) << 1 |
+                             (w[i] + y[i] < 0) << 2 | (w[i] - y[i] < 0) << 3 |
+                             (w[i] + z[i] < 0) << 4 | (w[i] - z[i] < 0) << 5);
+    }
+
+    VertexBatch4 result;
+    result.attrs = batch.attrs;
+    std::vector<double> poly, clipped;
+    for (size_t p = 0; p < batch.polygons(); ++p) {
+        size_t begin = batch.offsets[p], end = batch.offsets[p + 1];
+        uint8_t all = 0x3f, any = 0;
+        for (size_t i = begin; i < end; ++i) {
+            all &= codes[i];
+            any |= codes[i];
+        }
+        if (all || end == begin) {
+            result.close();
+            continue;
+        }
+        poly.clear();
+        for (size_t i = begin; i < end; ++i) {
+            poly.push_back(x[i]);
+            poly.push_back(y[i]);
+            poly.push_back(z[i]);
+            poly.push_back(w[i]);
+            poly.insert(poly.end(), batch.attr.begin() + i * batch.attrs, batch.attr.begin() + (i + 1) * batch.attrs);
+        }
+        bool nonEmpty = true;
+        for (int k = 0; k < 6 && nonEmpty; ++k) {
+            if (!(any & (1 << k))) continue;
+            nonEmpty = clipPolygonToPlane(poly, stride, FRUSTUM_PLANES[k], clipped);
+            poly.swap(clipped);
+        }
+        if (nonEmpty)
+            for (size_t i = 0; i < poly.size(); i += stride) result.push(&poly[i]);
+        result.close();
+    }
+    return result;
+}
+
+/// @struct Mesh
+/// @brief Индексированная сетка: общий буфер вершин и многоугольники из индексов
+struct Mesh {
+    std::vector<Point> vertices;              ///< Буфер вершин
+    std::vector<std::array<uint32_t, 3>> faces; ///< Треугольники как индексы вершин
+};
+
+/// @brief Отсечь индексированную сетку выпуклым планом с сохранением общих вершин
+/// @param mesh Исходная сетка (грани — треугольники или многоугольники)
+/// @param plan Нормализованный план выпуклого отсекателя
+/// @return Сетка из треугольников (веер по каждой отсечённой грани) с уплотнённым буфером
+///
+/// На каждом ребре плана каждая вершина классифицируется один раз, а точка пересечения
+/// каждого ребра сетки считается один раз и находится соседней гранью через хеш ребра.
+/// Параметр вычисляется от меньшего индекса к большему, поэтому совпадает у обеих граней.
+Mesh clipMesh(const Mesh& mesh, const ClipPlan& plan) {
+    Mesh result;
+    if (!plan.valid()) return result;
+    std::vector<Point> vertices(mesh.vertices);
+    // Грани подряд (CSR): индексы вершин и концы граней; после отсечения грань — многоугольник
+    std::vector<uint32_t> faces, clipped;
+    std::vector<size_t> ends, clippedEnds;
+    faces.reserve(3 * mesh.faces.size());
+    for (const auto& face : mesh.faces) {
+        faces.insert(faces.end(), face.begin(), face.end());
+        ends.push_back(faces.size());
+    }
+    std::vector<double> dist;
+    std::unordered_map<uint64_t, uint32_t> crossings;
+    for (size_t k = 0; k < plan.edges.size() && !ends.empty(); ++k) {
+        double a = plan.a[k], b = plan.b[k], c = plan.c[k];
+        size_t n = vertices.size();
+        dist.resize(n);
+        for (size_t i = 0; i < n; ++i) dist[i] = a * vertices[i].x + b * vertices[i].y + c;
+        crossings.clear();
+        clipped.clear();
+        clippedEnds.clear();
+        for (size_t f = 0; f < ends.size(); ++f) {
+            const uint32_t* face = faces.data() + (f ? ends[f - 1] : 0);
+            size_t size = ends[f] - (f ? ends[f - 1] : 0), start = clipped.size();
+            for (size_t i = 0; i < size; ++i) {
+                uint32_t org = face[i], dest = face[(i + 1) % size];
+                bool orgInside = dist[org] <= 0, destInside = dist[dest] <= 0;
+                if (orgInside != destInside) {
+                    uint32_t lo = std::min(org, dest), hi = std::max(org, dest);
+                    auto inserted = crossings.emplace((uint64_t)lo << 32 | hi, (uint32_t)vertices.size());
+                    if (inserted.second) {
+                        double t = dist[lo] / (dist[lo] - dist[hi]);
+                        const Point& p = vertices[lo];
+                        const Point& q = vertices[hi];
+                        vertices.push_back(Point(p.x + t * (q.x - p.x), p.y + t * (q.y - p.y)));
+                    }
+                    clipped.push_back(inserted.first->second);
+                }
+                if (destInside) clipped.push_back(dest);
+            }
+            if (clipped.size() - start >= 3) clippedEnds.push_back(clipped.size());
+            else clipped.resize(start);
+        }
+        faces.swap(clipped);
+        ends.swap(clippedEnds);
+    }
+
+    std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+    auto use = [&](uint32_t v) {
+        if (remap[v] == UINT32_MAX) {
+            remap[v] = result.vertices.size();
+            result.vertices.push_back(vertices[v]);
+        }
+        return remap[v];
+    };
+    for (size_t f = 0; f < ends.size(); ++f) {
+        const uint32_t* face = faces.data() + (f ? ends[f - 1] : 0);
+        size_t size = ends[f] - (f ? ends[f - 1] : 0);
+        for (size_t i = 1; i + 1 < size; ++i) result.faces.push_back({use(face[0]), use(face[i]), use(face[i + 1])});
+    }
+    return result;
+}
+
+/// @brief Хеш вершин многоугольника в порядке обхода
+uint64_t hashPolygon(Polygon& p) {
+    uint64_t h = 1469598103934665603ull;
+    for (int i = 0; i < p.size(); p.advance(CLOCKWISE), i++) {
+        Point v = p.getPoint();
+        uint64_t bits[2];
+        std::memcpy(bits, &v.x, sizeof(double));
+        std::memcpy(bits + 1, &v.y, sizeof(double));
+        for (uint64_t b : bits) h = (h ^ b) * 1099511628211ull;
+    }
+    return h;
+}
+
+/// @class PlanCache
+/// @brief Кеш планов по хешу отсекателя с вытеснением давно не использованных
+///
+/// Повторяющиеся окна отсечения нормализуются один раз: ориентация и рёбра берутся из кеша.
+class PlanCache {
+public:
+    /// @brief Конструктор
+    /// @param capacity Максимальное число планов
+    explicit PlanCache(size_t capacity) : _capacity(capacity) {}
+
+    /// @brief Получить план для отсекателя, построив его при промахе
+    /// @param p Отсекающий многоугольник
+    std::shared_ptr<const ClipPlan> get(Polygon& p) {
+        uint64_t key = hashPolygon(p);
+        {
+            LOCK(lock, _mutex);
+            auto it = _index.find(key);
+            if (it != _index.end() && samePolygon(*it->second->second, p)) {
+                _lru.splice(_lru.begin(), _lru, it->second);
+                return it->second->second;
+            }
+        }
+        std::shared_ptr<const ClipPlan> plan = std::make_shared<const ClipPlan>(p);
+        LOCK(lock, _mutex);
+        auto it = _index.find(key);
+        if (it != _index.end()) {
+            _lru.erase(it->second);
+            _index.erase(it);
+        }
+        _lru.emplace_front(key, plan);
+        _index[key] = _lru.begin();
+        if (_lru.size() > _capacity) {
+            _index.erase(_lru.back().first);
+            _lru.pop_back();
+        }
+        return plan;
+    }
+
+    /// @brief Проверка на коллизию хеша: план построен ровно по этим вершинам
+    /// @note Многоугольник не сдвигается: обход идёт своим указателем от текущей вершины
+    static bool samePolygon(const ClipPlan& plan, const Polygon& p) {
+        if ((int)plan.vertices.size() != p.size()) return false;
+        Vertex* v = p._v;
+        for (const Point& q : plan.vertices) {
+            if (v->x != q.x || v->y != q.y) return false;
+            v = v->cw();
+        }
+        return true;
+    }
+
+private:
+    typedef std::list<std::pair<uint64_t, std::shared_ptr<const ClipPlan>>> LruList;
+
+    size_t _capacity;  ///< Максимальное число планов
+    LruList _lru;      ///< Планы от недавних к давним
+    std::unordered_map<uint64_t, LruList::iterator> _index; ///< Хеш отсекателя -> элемент списка
+    std::mutex _mutex; ///< Доступ из потоков транспортов
+};
+
+/// @brief Проверка выпуклости многоугольника, обходимого против часовой стрелки
+bool isConvex(const std::vector<Point>& ccw) {
+    size_t n = ccw.size();
+    for (size_t i = 0; i < n; ++i)
+        if (cross(ccw[i], ccw[(i + 1) % n], ccw[(i + 2) % n]) < 0) return false;
+    return true;
+}
+
+/// @brief Триангуляция простого многоугольника отсечением ушей
+/// @param ccw Вершины против часовой стрелки
+/// @return Тройки индексов вершин, каждая против часовой стрелки
+/// @throws std::runtime_error если многоугольник не простой
+std::vector<std::array<int, 3>> triangulate(const std::vector<Point>& ccw) {
+    std::vector<int> idx(ccw.size());
+    for (size_t i = 0; i < idx.size(); ++i) idx[i] = i;
+    std::vector<std::array<int, 3>> triangles;
+    while (idx.size() > 3) {
+        size_t n = idx.size();
+        bool clipped = false;
+        for (size_t i = 0; i < n && !clipped; ++i) {
+            int a = idx[(i + n - 1) % n], b = idx[i], c = idx[(i + 1) % n];
+            if (cross(ccw[a], ccw[b], ccw[c]) <= 0) continue;
+            bool ear = true;
+            for (size_t j = 0; j < n && ear; ++j) {
+                int v = idx[j];
+                if (v == a || v == b || v == c) continue;
+                if (cross(ccw[a], ccw[b], ccw[v]) >= 0 && cross(ccw[b], ccw[c], ccw[v]) >= 0 &&
+                    cross(ccw[c], ccw[a], ccw[v]) >= 0) ear = false;
+            }
+            if (!ear) continue;
+            triangles.push_back({a, b, c});
+            idx.erase(idx.begin() + i);
+            clipped = true;
+        }
+        if (clipped) continue;
+        // Ушей нет: допустимы только вырожденные вершины на одной прямой с соседями
+        for (size_t i = 0; i < n && !clipped; ++i) {
+            if (cross(ccw[idx[(i + n - 1) % n]], ccw[idx[i]], ccw[idx[(i + 1) % n]]) != 0) continue;
+            idx.erase(idx.begin() + i);
+            clipped = true;
+        }
+        if (!clipped) throw std::runtime_error("Polygon is not simple");
+    }
+    if (cross(ccw[idx[0]], ccw[idx[1]], ccw[idx[2]]) > 0) triangles.push_back({idx[0], idx[1], idx[2]});
+    return triangles;
+}
+
+/// @brief Выпуклое разбиение Хертеля-Мельхорна поверх триангуляции
+/// @param ccw Вершины простого многоугольника против часовой стрелки
+/// @return Выпуклые части как списки индексов вершин против часовой стрелки
+///
+/// Диагонали триангуляции удаляются, пока обе примыкающие части остаются выпуклыми;
+/// частей получается не больше чем вчетверо против оптимума.
+std::vector<std::vector<int>> decomposeConvex(const std::vector<Point>& ccw) {
+    std::vector<std::vector<int>> pieces;
+    for (const auto& t : triangulate(ccw)) pieces.push_back({t[0], t[1], t[2]});
+
+    // Часть, содержащая направленное ребро i -> j, и позиция i в ней
+    auto find = [&](int i, int j, size_t& pos) -> int {
+        for (size_t k = 0; k < pieces.size(); ++k) {
+            const std::vector<int>& piece = pieces[k];
+            for (size_t m = 0; m < piece.size(); ++m) {
+                if (piece[m] == i && piece[(m + 1) % piece.size()] == j) {
+                    pos = m;
+                    return k;
+                }
+            }
+        }
+        return -1;
+    };
+
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (size_t p = 0; p < pieces.size() && !merged; ++p) {
+            for (size_t m = 0; m < pieces[p].size() && !merged; ++m) {
+                const std::vector<int>& P = pieces[p];
+                size_t np = P.size();
+                int i = P[m], j = P[(m + 1) % np];
+                size_t qm;
+                int q = find(j, i, qm);
+                if (q < 0 || q == (int)p) continue;
+                const std::vector<int>& Q = pieces[q];
+                size_t nq = Q.size();
+                // После слияния у i предшественник из P, преемник из Q; у j — наоборот
+                int prevI = P[(m + np - 1) % np], nextI = Q[(qm + 2) % nq];
+                int prevJ = Q[(qm + nq - 1) % nq], nextJ = P[(m + 2) % np];
+                if (cross(ccw[prevI], ccw[i], ccw[nextI]) < 0) continue;
+                if (cross(ccw[prevJ], ccw[j], ccw[nextJ]) < 0) continue;
+                std::vector<int> joined;
+                for (size_t k = 0; k < np; ++k) joined.push_back(P[(m + 1 + k) % np]);   // j ... i
+                for (size_t k = 1; k + 1 < nq; ++k) joined.push_back(Q[(qm + 1 + k) % nq]); // после i ... до j
+                pieces[p] = joined;
+                pieces.erase(pieces.begin() + q);
+                merged = true;
+            }
+        }
+    }
+    return pieces;
+}
+
+/// @class SnapGrid
+/// @brief Сведение близких точек к общему узлу сетки для склейки колец
+class SnapGrid {
+public:
+    typedef std::pair<long long, long long> Key;
+
+    /// @brief Конструктор: шаг сетки MERGE_EPSILON от размера данных
+    /// @param rings Кольца, точки которых будут сводиться
+    explicit SnapGrid(const std::vector<std::vector<Point>>& rings) {
+        double extent = 1;
+        for (const auto& ring : rings)
+            for (const Point& v : ring) extent = std::max(extent, std::max(std::abs(v.x), std::abs(v.y)));
+        eps = extent * MERGE_EPSILON;
+    }
+
+    /// @brief Узел сетки для точки; первая точка узла становится его представителем
+    Key snap(const Point& v) {
+        Key k(std::llround(v.x / eps), std::llround(v.y / eps));
+        points.emplace(k, v);
+        return k;
+    }
+
+    double eps;                  ///< Шаг сетки
+    std::map<Key, Point> points; ///< Представители узлов
+};
+
+/// @brief Сшить направленные рёбра в замкнутые кольца
+/// @param outgoing Рёбра "узел -> узел"; опустошается
+/// @param grid Сетка с представителями узлов
+std::vector<std::vector<Point>> stitchRings(std::multimap<SnapGrid::Key, SnapGrid::Key>& outgoing, SnapGrid& grid) {
+    std::vector<std::vector<Point>> rings;
+    while (!outgoing.empty()) {
+        auto it = outgoing.begin();
+        SnapGrid::Key start = it->first, at = it->second;
+        outgoing.erase(it);
+        std::vector<Point> ring{grid.points[start]};
+        while (at != start) {
+            ring.push_back(grid.points[at]);
+            auto next = outgoing.find(at);
+            if (next == outgoing.end()) break;
+            at = next->second;
+            outgoing.erase(next);
+        }
+        if (at == start && ring.size() >= 3) rings.push_back(ring);
+    }
+    return rings;
+}
+
+/// @brief Склеить результаты отсечения смежными выпуклыми частями
+/// @param pieces Кольца результатов частей (одинаковой ориентации)
+/// @return Кольца объединения
+///
+/// Точки сводятся к сетке с шагом MERGE_EPSILON от размера данных, рёбра делятся в
+/// вершинах, лежащих на них, и пары противонаправленных рёбер по общим диагоналям
+/// взаимно уничтожаются. Оставшиеся рёбра сшиваются в кольца.
+std::vector<std::vector<Point>> mergePieces(const std::vector<std::vector<Point>>& pieces) {
+    typedef SnapGrid::Key Key;
+    SnapGrid grid(pieces);
+    std::vector<std::pair<Key, Key>> edges;
+    for (const auto& ring : pieces) {
+        for (size_t i = 0; i < ring.size(); ++i) {
+            Key a = grid.snap(ring[i]), b = grid.snap(ring[(i + 1) % ring.size()]);
+            if (a != b) edges.push_back({a, b});
+        }
+    }
+
+    // Деление рёбер вершинами, лежащими внутри них (Т-образные стыки на диагоналях)
+    std::vector<std::pair<Key, Key>> split;
+    for (const auto& e : edges) {
+        const Point& a = grid.points[e.first];
+        const Point& b = grid.points[e.second];
+        double len = (b - a).length();
+        std::vector<std::pair<double, Key>> inner;
+        auto lo = grid.points.lower_bound(Key(std::min(e.first.first, e.second.first), LLONG_MIN));
+        auto hi = grid.points.upper_bound(Key(std::max(e.first.first, e.second.first), LLONG_MAX));
+        for (auto it = lo; it != hi; ++it) {
+            if (it->first == e.first || it->first == e.second) continue;
+            const Point& v = it->second;
+            if (std::abs(cross(a, b, v)) > grid.eps * len) continue;
+            double t = ((v.x - a.x) * (b.x - a.x) + (v.y - a.y) * (b.y - a.y)) / (len * len);
+            if (t > 0 && t < 1) inner.push_back({t, it->first});
+        }
+        std::sort(inner.begin(), inner.end());
+        Key from = e.first;
+        for (const auto& v : inner) {
+            split.push_back({from, v.second});
+            from = v.second;
+        }
+        split.push_back({from, e.second});
+    }
+
+    std::map<std::pair<Key, Key>, int> count;
+    for (const auto& e : split) {
+        auto reverse = count.find({e.second, e.first});
+        if (reverse != count.end() && reverse->second > 0) reverse->second--;
+        else count[e]++;
+    }
+    std::multimap<Key, Key> outgoing;
+    for (const auto& e : count)
+        for (int k = 0; k < e.second; ++k) outgoing.emplace(e.first.first, e.first.second);
+    return stitchRings(outgoing, grid);
+}
+
+/// @class JobCancelled
+/// @brief Задание отменено администратором
+struct JobCancelled : std::runtime_error {
+    JobCancelled() : std::runtime_error("Job cancelled") {}
+};
+
+/// @brief Флаг отмены задания, которое выполняет текущий поток (nullptr — вне задания)
+thread_local const std::atomic<bool>* currentCancel = nullptr;
+
+/// @brief Точка кооперативной отмены
+/// @throws JobCancelled если задание текущего потока отменено
+inline void checkCancelled() {
+    if (currentCancel && currentCancel->load(std::memory_order_relaxed)) throw JobCancelled();
+}
+
+/// @class WorkerPool
+/// @brief Пул потоков для распараллеливания внутри одного запроса
+class WorkerPool {
+public:
+    /// @brief Конструктор
+    /// @param threads Число потоков
+    explicit WorkerPool(unsigned threads) : _stop(false) {
+        for (unsigned i = 0; i < threads; ++i) _threads.emplace_back(&WorkerPool::run, this);
+    }
+
+    /// @brief Деструктор: дожидается завершения потоков
+    ~WorkerPool() {
+        {
+            LOCK(lock, _mutex);
+            _stop = true;
+        }
+        _cv.notify_all();
+        for (auto& t : _threads) t.join();
+    }
+
+    /// @brief Выполнить fn(0..n-1) параллельно
+    /// @param n Число итераций
+    /// @param fn Тело итерации
+    ///
+    /// Вызывающий поток сам разбирает итерации вместе с пулом, поэтому вложенные
+    /// вызовы не приводят к взаимной блокировке. Флаг отмены вызывающего задания
+    /// передаётся потокам пула и проверяется перед каждой итерацией.
+    void parallelFor(size_t n, const std::function<void(size_t)>& fn) {
+        struct State {
+            std::atomic<size_t> next{0}, done{0};
+            size_t n;
+            std::function<void(size_t)> fn;
+            const std::atomic<bool>* cancel;
+            std::exception_ptr error;
+            std::mutex mutex;
+            std::condition_variable cv;
+        };
+        auto state = std::make_shared<State>();
+        state->n = n;
+        state->fn = fn;
+        state->cancel = currentCancel;
+        auto work = [state]() {
+            const std::atomic<bool>* outer = currentCancel;
+            currentCancel = state->cancel;
+            size_t i;
+            while ((i = state->next++) < state->n) {
+                try {
+                    checkCancelled();
+                    state->fn(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    if (!state->error) state->error = std::current_exception();
+                }
+                if (++state->done == state->n) {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->cv.notify_all();
+                }
+            }
+            currentCancel = outer;
+        };
+        size_t helpers = std::min<size_t>(_threads.size(), n ? n - 1 : 0);
+        {
+            LOCK(lock, _mutex);
+            for (size_t i = 0; i < helpers; ++i) _tasks.push_back(work);
+        }
+        _cv.notify_all();
+        work();
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->cv.wait(lock, [&]() { return state->done == state->n; });
+        if (state->error) std::rethrow_exception(state->error);
+    }
+
+private:
+    /// @brief Цикл рабочего потока
+    void run() {
+        while (true) {
+            std::function<void()> task;
+            {
+                LOCK(lock, _mutex);
+                _cv.wait(lock, [this]() { return _stop || !_tasks.empty(); });
+                if (_stop && _tasks.empty()) return;
+                task = std::move(_tasks.front());
+                _tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> _threads;        ///< Рабочие потоки
+    std::deque<std::function<void()>> _tasks; ///< Очередь задач
+    std::mutex _mutex;                        ///< Защита очереди
+    ServerCondition _cv;                      ///< Сигнал о новой задаче
+    bool _stop;                               ///< Признак остановки
+};
+
+/// @brief Общий пул потоков сервера
+WorkerPool workerPool(std::max(1u, std::thread::hardware_concurrency()));
+
+struct Tenant;
+
+/// @struct Job
+/// @brief Разобранный запрос, готовый к вычислению
+struct Job {
+    const char* name;                         ///< Команда запроса
+    size_t cost;                              ///< Оценка стоимости: число входных вершин
+    std::function<void(std::ostream&)> run;   ///< Вычисление и запись ответа
+    Tenant* tenant;                           ///< Арендатор (nullptr — по умолчанию)
+    std::shared_ptr<Polygon> clipper;         ///< Отсекатель, если задание можно вычислить в пакете
+    uint64_t batchKey;                        ///< Хеш отсекателя для группировки в пакет
+    std::function<void(const ClipPlan&, std::ostream&)> runPlanned; ///< Вычисление с готовым планом
+
+    Job() : name("CLIP"), cost(0), tenant(nullptr), batchKey(0) {}
+    Job(size_t cost, std::function<void(std::ostream&)> run)
+        : name("CLIP"), cost(cost), run(std::move(run)), tenant(nullptr), batchKey(0) {}
+};
+
+/// @struct Connection
+/// @brief Обслуживаемое соединение: состояние и счётчики для администрирования
+///
+/// Поля обновляет только поток соединения; администратор читает их без блокировок.
+struct Connection {
+    /// @brief Что соединение делает сейчас
+    enum State { READING, WAITING, WRITING };
+
+    uint64_t id;                     ///< Номер соединения
+    const char* transport;           ///< Транспорт
+    int64_t accepted;                ///< Время приёма, нс
+    std::atomic<int> state{READING}; ///< Текущее состояние
+    std::atomic<uint64_t> bytesIn{0};  ///< Принято байт
+    std::atomic<uint64_t> bytesOut{0}; ///< Отправлено байт
+    std::atomic<uint64_t> job{0};      ///< Текущее или последнее задание
+    FdStreamBuf* source = nullptr;     ///< Поток запросов, если запросы разбираются из сокета
+
+    /// @brief Запомнить начало текущего запроса для журнала зависаний
+    void setInput(std::string text) {
+        LOCK(lock, _inputMutex);
+        _input = std::move(text);
+    }
+
+    /// @brief Начало текущего запроса
+    std::string input() {
+        LOCK(lock, _inputMutex);
+        return _input;
+    }
+
+private:
+    std::string _input;      ///< Начало текущего запроса
+    std::mutex _inputMutex;  ///< Защита _input (поток соединения и сторожевой поток)
+};
+
+/// @class ConnectionTable
+/// @brief Список обслуживаемых соединений
+///
+/// Блокировка берётся только при открытии, закрытии и выводе списка, а не на запрос.
+class ConnectionTable {
+public:
+    /// @brief Зарегистрировать соединение
+    /// @param transport Название транспорта (строковый литерал)
+    std::shared_ptr<Connection> open(const char* transport) {
+        auto connection = std::make_shared<Connection>();
+        connection->transport = transport;
+        connection->accepted = steadyNs();
+        LOCK(lock, _mutex);
+        connection->id = ++_lastId;
+        _connections[connection->id] = connection;
+        return connection;
+    }
+
+    /// @brief Снять соединение с учёта
+    void close(const Connection& connection) {
+        LOCK(lock, _mutex);
+        _connections.erase(connection.id);
+    }
+
+    /// @brief Снимок списка соединений
+    std::vector<std::shared_ptr<Connection>> list() {
+        LOCK(lock, _mutex);
+        std::vector<std::shared_ptr<Connection>> result;
+        for (const auto& c : _connections) result.push_back(c.second);
+        return result;
+    }
+
+private:
+    std::map<uint64_t, std::shared_ptr<Connection>> _connections; ///< Соединения по номерам
+    uint64_t _lastId = 0;                                         ///< Последний выданный номер
+    std::mutex _mutex;                                            ///< Защита списка
+};
+
+/// @brief Соединения сервера
+ConnectionTable connections;
+
+/// @struct Tenant
+/// @brief Арендатор: доля процессора, квота параллельных заданий, свой кеш планов и показатели
+///
+/// Арендаторы заводятся при запуске (--tenant); запрос относится к арендатору префиксом
+/// "TENANT имя", а без префикса или с незаведённым именем — к "default".
+struct Tenant {
+    /// @brief Конструктор
+    /// @param name Имя (проверено реестром)
+    explicit Tenant(const std::string& name)
+        : name(name), weight(1), quota(SCHEDULER_MAX_WORKERS), plans(PLAN_CACHE_CAPACITY),
+          jobs(metrics.counter("tenant." + name + ".jobs")), failed(metrics.counter("tenant." + name + ".failed")),
+          waitUs(metrics.histogram("tenant." + name + ".wait_us")),
+          latencyUs(metrics.histogram("tenant." + name + ".latency_us")) {}
+
+    const std::string name;        ///< Имя
+    std::atomic<double> weight;    ///< Вес в справедливой очереди
+    std::atomic<unsigned> quota;   ///< Наибольшее число одновременно выполняемых заданий
+    PlanCache plans;               ///< Свой раздел кеша планов: чужие окна его не вытесняют
+    std::atomic<int64_t>& jobs;    ///< Выполнено заданий
+    std::atomic<int64_t>& failed;  ///< Заданий с ошибкой или отменённых
+    Histogram& waitUs;             ///< Ожидание в очереди, мкс
+    Histogram& latencyUs;          ///< Время от приёма до ответа, мкс
+};
+
+/// @class TenantRegistry
+/// @brief Арендаторы по именам
+///
+/// Арендаторы создаются только настройкой сервера, поэтому клиенты не могут ни исчерпать
+/// TENANT_MAX произвольными именами, ни завести себе отдельную очередь в обход настройки.
+class TenantRegistry {
+public:
+    TenantRegistry() : _default(&create("default")) {}
+
+    /// @brief Завести арендатора (или вернуть уже заведённого)
+    /// @throws std::runtime_error если имя недопустимо или арендаторов слишком много
+    Tenant& create(const std::string& name) {
+        validate(name);
+        LOCK(lock, _mutex);
+        auto it = _tenants.find(name);
+        if (it != _tenants.end()) return *it->second;
+        if (_tenants.size() >= TENANT_MAX) throw std::runtime_error("Too many tenants");
+        return *(_tenants[name] = std::make_unique<Tenant>(name));
+    }
+
+    /// @brief Арендатор запроса по имени из префикса
+    /// @return Заведённый арендатор либо арендатор по умолчанию для незнакомого имени
+    /// @throws std::runtime_error если имя недопустимо
+    Tenant& resolve(const std::string& name) {
+        validate(name);
+        LOCK(lock, _mutex);
+        auto it = _tenants.find(name);
+        return it != _tenants.end() ? *it->second : *_default;
+    }
+
+    /// @brief Арендатор запросов без префикса
+    Tenant& defaultTenant() { return *_default; }
+
+    /// @brief Все арендаторы
+    std::vector<Tenant*> list() {
+        LOCK(lock, _mutex);
+        std::vector<Tenant*> result;
+        for (const auto& t : _tenants) result.push_back(t.second.get());
+        return result;
+    }
+
+private:
+    /// @brief Проверить имя: буквы, цифры, "_" и "-", не длиннее TENANT_NAME_MAX
+    static void validate(const std::string& name) {
+        if (name.empty() || name.size() > TENANT_NAME_MAX ||
+            !std::all_of(name.begin(), name.end(), [](char c) { return std::isalnum(c) || c == '_' || c == '-'; }))
+            throw std::runtime_error("Bad tenant name");
+    }
+
+    std::map<std::string, std::unique_ptr<Tenant>> _tenants; ///< Арендаторы по именам
+    std::mutex _mutex;                                       ///< Защита списка
+    Tenant* _default;                                        ///< Арендатор по умолчанию
+};
+
+/// @brief Арендаторы сервера
+TenantRegistry tenants;
+
+/// @brief Арендатор задания, которое выполняет текущий поток (nullptr — вне задания)
+thread_local Tenant* currentTenant = nullptr;
+
+/// @brief Кеш планов арендатора текущего задания
+PlanCache& currentPlans() { return (currentTenant ? *currentTenant : tenants.defaultTenant()).plans; }
+
+/// @class Scheduler
+/// @brief Очередь заданий и вычислительные потоки сервера
+///
+/// Потоки соединений только разбирают запросы и ждут ответа, вычисления идут здесь.
+/// У каждого арендатора своя очередь; следующим берётся задание арендатора с наименьшим
+/// виртуальным временем, которое растёт на стоимость задания, делённую на вес
+/// (справедливая очередь по стоимости), при условии, что арендатор не исчерпал квоту
+/// параллельных заданий. Задания с отсекателем (clipper), ждущие в очереди арендатора
+/// с тем же отсекателем, поток забирает пакетом: план берётся один раз, субъекты
+/// отсекаются им подряд или параллельно, каждый ответ уходит своему соединению. Окно
+/// пакетирования (setBatchWindow) позволяет первому заданию подождать попутчиков;
+/// по умолчанию оно нулевое и пакет собирается только из уже ждущих заданий.
+/// Планировщик ведёт показатели загрузки для балансировщика (запрос "LOAD"), а каждый
+/// вычислительный поток публикует своё задание в слоте под seqlock, так что
+/// администратор читает их, не останавливая потоки.
+class Scheduler {
+public:
+    /// @struct Load
+    /// @brief Снимок загрузки
+    struct Load {
+        size_t queued;    ///< Заданий в очереди
+        size_t running;   ///< Заданий в вычислении
+        uint64_t cost;    ///< Суммарная оценка стоимости принятых заданий
+        double latencyMs; ///< Скользящее среднее времени от приёма до ответа, мс
+    };
+
+    /// @struct Stats
+    /// @brief Накопленные с запуска счётчики для подстройки числа потоков
+    struct Stats {
+        uint64_t started;   ///< Начато заданий
+        uint64_t completed; ///< Завершено заданий
+        uint64_t waitNs;    ///< Суммарное ожидание начатых заданий в очереди
+        uint64_t busyNs;    ///< Суммарное время вычисления
+    };
+
+    /// @struct JobInfo
+    /// @brief Задание, выполняемое вычислительным потоком
+    struct JobInfo {
+        uint64_t id;      ///< Номер задания
+        const char* name; ///< Команда
+        size_t cost;      ///< Оценка стоимости
+        int64_t started;  ///< Начало вычисления, нс
+        unsigned worker;  ///< Номер потока
+        std::vector<uint64_t> batch; ///< Номера всех заданий пакета, первый — id
+    };
+
+    /// @brief Конструктор
+    /// @param workers Начальное число вычислительных потоков
+    explicit Scheduler(unsigned workers)
+        : _threads(SCHEDULER_MAX_WORKERS), _alive(SCHEDULER_MAX_WORKERS, false),
+          _slots(new WorkerSlot[SCHEDULER_MAX_WORKERS]), _target(0), _lastId(0), _queued(0), _running(0), _cost(0),
+          _latencyMs(0), _started(0), _completed(0), _waitNs(0), _busyNs(0), _batchWindowUs(0), _stop(false) {
+        resize(workers);
+    }
+
+    /// @brief Деструктор: дожидается завершения потоков
+    ~Scheduler() {
+        {
+            LOCK(lock, _mutex);
+            _stop = true;
+        }
+        _cv.notify_all();
+        for (auto& t : _threads)
+            if (t.joinable()) t.join();
+    }
+
+    /// @brief Изменить число вычислительных потоков
+    /// @param workers Новое число (приводится к 1..SCHEDULER_MAX_WORKERS)
+    ///
+    /// Лишние потоки завершаются, когда освобождаются от текущего задания.
+    void resize(unsigned workers) {
+        workers = std::max(1u, std::min(workers, SCHEDULER_MAX_WORKERS));
+        {
+            LOCK(lock, _mutex);
+            _target = workers;
+            for (unsigned i = 0; i < workers; ++i) {
+                if (_alive[i]) continue;
+                if (_threads[i].joinable()) _threads[i].join();
+                _threads[i] = std::thread(&Scheduler::run, this, i);
+                _alive[i] = true;
+            }
+        }
+        _cv.notify_all();
+    }
+
+    /// @brief Сколько первое задание пакета ждёт попутчиков с тем же отсекателем, мкс
+    void setBatchWindow(int64_t us) { _batchWindowUs = std::max<int64_t>(0, us); }
+
+    /// @brief Выполнить задание и дождаться ответа
+    /// @param job Задание
+    /// @param connection Соединение, ждущее ответа (для администрирования), или nullptr
+    /// @return Текст ответа; "ERROR" если вычисление бросило исключение или задание отменено
+    std::string execute(Job job, Connection* connection = nullptr) {
+        auto task = std::make_shared<Task>();
+        task->job = std::move(job);
+        if (!task->job.tenant) task->job.tenant = &tenants.defaultTenant();
+        task->accepted = std::chrono::steady_clock::now();
+        std::future<std::string> response = task->response.get_future();
+        {
+            LOCK(lock, _mutex);
+            task->id = ++_lastId;
+            Lane& lane = _lanes[task->job.tenant];
+            if (lane.queue.empty()) lane.virtualTime = std::max(lane.virtualTime, _virtualTime);
+            lane.queue.push_back(task);
+            _active[task->id] = task;
+            ++_queued;
+            _cost += task->job.cost;
+        }
+        if (connection) {
+            connection->job = task->id;
+            connection->state = Connection::WAITING;
+        }
+        _cv.notify_all();
+        return response.get();
+    }
+
+    /// @brief Отменить задание в очереди или в вычислении
+    /// @return false если задания с таким номером нет
+    ///
+    /// Отмена кооперативная: задание в очереди не начнётся, а выполняемое прервётся
+    /// в ближайшей точке checkCancelled() (в том числе на итерациях parallelFor).
+    /// Задание выполняемого пакета остаётся в _active до finish() и отменяется отдельно
+    /// от остальных заданий пакета.
+    bool cancel(uint64_t id) {
+        LOCK(lock, _mutex);
+        auto it = _active.find(id);
+        if (it == _active.end()) return false;
+        it->second->cancelled = true;
+        return true;
+    }
+
+    /// @brief Текущая загрузка (без блокировок)
+    Load load() const { return Load{_queued, _running, _cost, _latencyMs}; }
+
+    /// @brief Число вычислительных потоков
+    unsigned workers() const { return _target; }
+
+    /// @brief Заданий арендатора в очереди и в вычислении
+    std::pair<size_t, size_t> tenantLoad(Tenant* tenant) {
+        LOCK(lock, _mutex);
+        auto it = _lanes.find(tenant);
+        return it == _lanes.end() ? std::make_pair(size_t(0), size_t(0))
+                                  : std::make_pair(it->second.queue.size(), size_t(it->second.running));
+    }
+
+    /// @brief Накопленные счётчики (без блокировок)
+    Stats stats() const { return Stats{_started, _completed, _waitNs, _busyNs}; }
+
+    /// @brief Системный дескриптор вычислительного потока (для снимка стека)
+    pthread_t nativeHandle(unsigned worker) {
+        LOCK(lock, _mutex);
+        return _threads[worker].native_handle();
+    }
+
+    /// @brief Задания, выполняемые сейчас, по слотам потоков (без блокировок)
+    ///
+    /// Пакет занимает один слот: номера всех его заданий — в JobInfo::batch.
+    std::vector<JobInfo> jobs() const {
+        std::vector<JobInfo> result;
+        for (unsigned i = 0; i < SCHEDULER_MAX_WORKERS; ++i) {
+            JobInfo info;
+            if (_slots[i].read(info) && info.id) {
+                info.worker = i;
+                result.push_back(info);
+            }
+        }
+        return result;
+    }
+
+private:
+    /// @struct Task
+    /// @brief Задание в очереди
+    struct Task {
+        uint64_t id;                                    ///< Номер задания
+        Job job;                                        ///< Задание
+        std::chrono::steady_clock::time_point accepted; ///< Время приёма
+        std::promise<std::string> response;             ///< Ответ для потока соединения
+        std::atomic<bool> cancelled{false};             ///< Задание отменено
+    };
+
+    /// @struct Lane
+    /// @brief Очередь арендатора
+    struct Lane {
+        std::deque<std::shared_ptr<Task>> queue; ///< Задания в порядке приёма
+        double virtualTime = 0;                  ///< Виртуальное время: стоимость / вес выданных заданий
+        unsigned running = 0;                    ///< Заданий в вычислении
+    };
+
+    /// @brief Очередь, из которой брать следующее задание (под _mutex)
+    /// @return nullptr если брать нечего
+    std::pair<Tenant* const, Lane>* nextLane() {
+        std::pair<Tenant* const, Lane>* best = nullptr;
+        for (auto& lane : _lanes) {
+            if (lane.second.queue.empty() || lane.second.running >= lane.first->quota) continue;
+            if (!best || lane.second.virtualTime < best->second.virtualTime) best = &lane;
+        }
+        return best;
+    }
+
+    /// @struct WorkerSlot
+    /// @brief Задание вычислительного потока под seqlock: нечётный seq — идёт запись
+    struct WorkerSlot {
+        std::atomic<uint64_t> seq{0};
+        std::atomic<uint64_t> id{0};          ///< Номер задания, 0 — поток свободен
+        std::atomic<const char*> name{nullptr};
+        std::atomic<size_t> cost{0};
+        std::atomic<int64_t> started{0};
+        std::atomic<size_t> size{0};                           ///< Заданий в пакете
+        std::atomic<uint64_t> members[SCHEDULER_MAX_BATCH]{}; ///< Номера заданий пакета
+
+        /// @brief Опубликовать пакет заданий (пишет только свой поток)
+        /// @param batch Задания пакета; пустой пакет — поток свободен
+        /// @param batchCost Суммарная стоимость пакета
+        void publish(const std::vector<std::shared_ptr<Task>>& batch, size_t batchCost) {
+            seq.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            id.store(batch.empty() ? 0 : batch.front()->id, std::memory_order_relaxed);
+            name.store(batch.empty() ? nullptr : batch.front()->job.name, std::memory_order_relaxed);
+            cost.store(batchCost, std::memory_order_relaxed);
+            started.store(steadyNs(), std::memory_order_relaxed);
+            size.store(batch.size(), std::memory_order_relaxed);
+            for (size_t i = 0; i < batch.size(); ++i) members[i].store(batch[i]->id, std::memory_order_relaxed);
+            seq.fetch_add(1, std::memory_order_release);
+        }
+
+        /// @brief Прочитать согласованный снимок
+        /// @return false если запись не закончилась за несколько попыток
+        bool read(JobInfo& info) const {
+            for (int attempt = 0; attempt < 16; ++attempt) {
+                uint64_t before = seq.load(std::memory_order_acquire);
+                if (before & 1) continue;
+                info.id = id.load(std::memory_order_relaxed);
+                info.name = name.load(std::memory_order_relaxed);
+                info.cost = cost.load(std::memory_order_relaxed);
+                info.started = started.load(std::memory_order_relaxed);
+                info.batch.resize(std::min(size.load(std::memory_order_relaxed), SCHEDULER_MAX_BATCH));
+                for (size_t i = 0; i < info.batch.size(); ++i) info.batch[i] = members[i].load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (seq.load(std::memory_order_relaxed) == before) return true;
+            }
+            return false;
+        }
+    };
+
+    typedef std::pair<Tenant* const, Lane> LaneEntry;
+
+    /// @brief Забрать задание из очереди арендатора (под _mutex)
+    void take(LaneEntry& lane, const std::shared_ptr<Task>& task) {
+        _virtualTime = lane.second.virtualTime;
+        lane.second.virtualTime += (task->job.cost + 1) / lane.first->weight;
+        ++lane.second.running;
+        --_queued;
+        ++_running;
+    }
+
+    /// @brief Добрать в пакет ждущие задания с тем же отсекателем (под _mutex)
+    void collect(LaneEntry& lane, std::vector<std::shared_ptr<Task>>& batch) {
+        auto& queue = lane.second.queue;
+        for (auto it = queue.begin(); it != queue.end() && batch.size() < SCHEDULER_MAX_BATCH &&
+                                      lane.second.running < lane.first->quota;) {
+            if ((*it)->job.clipper && (*it)->job.batchKey == batch.front()->job.batchKey) {
+                take(lane, *it);
+                batch.push_back(std::move(*it));
+                it = queue.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    /// @brief Учесть начало вычисления задания
+    void begin(Task& task) {
+        int64_t waitNs = std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - task.accepted).count());
+        _waitNs += waitNs;
+        task.job.tenant->waitUs.record(waitNs / 1000);
+        ++_started;
+    }
+
+    /// @brief Вычислить задание в его контексте отмены и арендатора
+    /// @return Ответ; "ERROR" при исключении или отмене
+    template <class Fn>
+    static std::string guarded(Task& task, Fn&& fn) {
+        static auto& completed = metrics.counter("scheduler.jobs_completed");
+        static auto& failed = metrics.counter("scheduler.jobs_failed");
+        static auto& cancelled = metrics.counter("scheduler.jobs_cancelled");
+        Tenant& tenant = *task.job.tenant;
+        const std::atomic<bool>* outerCancel = currentCancel;
+        Tenant* outerTenant = currentTenant;
+        currentCancel = &task.cancelled;
+        currentTenant = &tenant;
+        std::string response = "ERROR\n";
+        try {
+            checkCancelled();
+            std::ostringstream out;
+            fn(out);
+            response = out.str();
+            ++completed;
+            ++tenant.jobs;
+        } catch (const JobCancelled&) {
+            ++cancelled;
+            ++tenant.failed;
+        } catch (...) {
+            ++failed;
+            ++tenant.failed;
+        }
+        currentCancel = outerCancel;
+        currentTenant = outerTenant;
+        return response;
+    }
+
+    /// @brief Завершить задание: счётчики, освобождение квоты и ответ
+    void finish(Task& task, std::string response) {
+        Tenant& tenant = *task.job.tenant;
+        ++_completed;
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - task.accepted).count();
+        tenant.latencyUs.record(uint64_t(ms * 1000));
+        {
+            LOCK(lock, _mutex);
+            --_lanes[&tenant].running;
+            _active.erase(task.id);
+            --_running;
+            _cost -= task.job.cost;
+            _latencyMs = _latencyMs + LOAD_EWMA_WEIGHT * (ms - _latencyMs);
+        }
+        if (tenant.quota < SCHEDULER_MAX_WORKERS) _cv.notify_all(); // освободилась квота
+        task.response.set_value(std::move(response));
+    }
+
+    /// @brief Вычислить пакет заданий с общим отсекателем
+    ///
+    /// План строится (или берётся из кеша) один раз по отсекателю первого задания;
+    /// задание, чей отсекатель лишь совпал по хешу, вычисляется обычным путём.
+    void runBatch(std::vector<std::shared_ptr<Task>>& batch) {
+        static auto& batches = metrics.counter("scheduler.batches");
+        static auto& batched = metrics.counter("scheduler.batched_jobs");
+        ++batches;
+        batched += batch.size();
+        std::shared_ptr<const ClipPlan> plan;
+        currentTenant = batch.front()->job.tenant;
+        try {
+            plan = currentPlans().get(*batch.front()->job.clipper);
+        } catch (...) {}
+        currentTenant = nullptr;
+        std::vector<std::string> responses(batch.size());
+        size_t cost = 0;
+        for (const auto& task : batch) cost += task->job.cost;
+        auto runTask = [&](size_t i) {
+            Task& task = *batch[i];
+            bool shared = plan && (i == 0 || PlanCache::samePolygon(*plan, *task.job.clipper));
+            responses[i] = guarded(task, [&](std::ostream& out) {
+                if (shared) task.job.runPlanned(*plan, out);
+                else task.job.run(out);
+            });
+        };
+        if (cost >= PARALLEL_MIN_WORK) workerPool.parallelFor(batch.size(), runTask);
+        else for (size_t i = 0; i < batch.size(); ++i) runTask(i);
+        for (size_t i = 0; i < batch.size(); ++i) finish(*batch[i], std::move(responses[i]));
+    }
+
+    /// @brief Цикл вычислительного потока
+    /// @param worker Номер потока
+    void run(unsigned worker) {
+        while (true) {
+            std::vector<std::shared_ptr<Task>> batch;
+            {
+                LOCK(lock, _mutex);
+                LaneEntry* lane = nullptr;
+                _cv.wait(lock, [&]() { return _stop || worker >= _target || (lane = nextLane()); });
+                if (worker >= _target || !lane) {
+                    _alive[worker] = false;
+                    return;
+                }
+                batch.push_back(std::move(lane->second.queue.front()));
+                lane->second.queue.pop_front();
+                take(*lane, batch.front());
+                if (batch.front()->job.clipper) {
+                    auto deadline = batch.front()->accepted + std::chrono::microseconds(_batchWindowUs.load());
+                    while (true) {
+                        collect(*lane, batch);
+                        if (_stop || batch.size() >= SCHEDULER_MAX_BATCH || std::chrono::steady_clock::now() >= deadline)
+                            break;
+                        _cv.wait_until(lock, deadline);
+                    }
+                }
+            }
+            int64_t start = steadyNs();
+            size_t cost = 0;
+            for (const auto& task : batch) {
+                begin(*task);
+                cost += task->job.cost;
+            }
+            Task& task = *batch.front();
+            _slots[worker].publish(batch, cost);
+            if (batch.size() > 1) {
+                runBatch(batch);
+            } else {
+                std::string response = guarded(task, [&](std::ostream& out) { task.job.run(out); });
+                finish(task, std::move(response));
+            }
+            _slots[worker].publish({}, 0);
+            _busyNs += steadyNs() - start;
+        }
+    }
+
+    std::vector<std::thread> _threads;         ///< Вычислительные потоки по номерам
+    std::vector<bool> _alive;                  ///< Поток с этим номером работает
+    std::unique_ptr<WorkerSlot[]> _slots;      ///< Слоты заданий потоков
+    std::atomic<unsigned> _target;             ///< Нужное число потоков
+    std::unordered_map<Tenant*, Lane> _lanes;  ///< Очереди арендаторов
+    double _virtualTime = 0;                   ///< Виртуальное время последнего выданного задания
+    std::unordered_map<uint64_t, std::shared_ptr<Task>> _active; ///< Задания в очереди и в работе
+    uint64_t _lastId;                          ///< Последний выданный номер задания
+    std::atomic<size_t> _queued;               ///< Заданий в очереди
+    std::atomic<size_t> _running;              ///< Заданий в вычислении
+    std::atomic<uint64_t> _cost;               ///< Стоимость принятых заданий
+    std::atomic<double> _latencyMs;            ///< Скользящее среднее задержки
+    std::atomic<uint64_t> _started, _completed; ///< Начато и завершено заданий
+    std::atomic<uint64_t> _waitNs, _busyNs;    ///< Ожидание в очереди и время вычисления
+    std::atomic<int64_t> _batchWindowUs;       ///< Окно пакетирования, мкс
+    std::mutex _mutex;                         ///< Защита очередей
+    ServerCondition _cv;                       ///< Сигнал о новом задании
+    bool _stop;                                ///< Признак остановки
+};
+
+/// @brief Планировщик заданий сервера
+Scheduler scheduler(std::max(1u, std::thread::hardware_concurrency()));
+
+/// @brief Процессорное время процесса в наносекундах
+inline int64_t processCpuNs() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/// @brief Счётчики ядер узла из /proc/stat: простой (idle + iowait) и всего, в тиках
+/// @return false если файл недоступен
+bool readHostCpu(uint64_t& idle, uint64_t& total) {
+    std::ifstream stat("/proc/stat");
+    std::string cpu;
+    uint64_t v;
+    if (!(stat >> cpu) || cpu != "cpu") return false;
+    idle = total = 0;
+    for (int i = 0; i < 10 && stat >> v; ++i) {
+        total += v;
+        if (i == 3 || i == 4) idle += v;
+    }
+    return total > 0;
+}
+
+/// @class WorkerTuner
+/// @brief Подстройка числа вычислительных потоков по очереди, занятости и загрузке процессора
+///
+/// Раз в TUNER_INTERVAL_MS сравниваются счётчики планировщика (среднее ожидание в очереди,
+/// доля занятости потоков, число заданий), процессорное время сервера и простой ядер узла.
+/// Поток добавляется, если задания ждут, потоки насыщены и у узла есть свободные ядра;
+/// убирается, если потоки простаивают или на занятом соседями узле им не хватает
+/// процессора. Решение принимается только после TUNER_HYSTERESIS периодов с одинаковым
+/// сигналом, а рост, не давший пропускной способности, откатывается и на время запрещается.
+class WorkerTuner {
+public:
+    /// @brief Конструктор
+    /// @param minWorkers Нижняя граница числа потоков
+    /// @param maxWorkers Верхняя граница числа потоков
+    WorkerTuner(unsigned minWorkers, unsigned maxWorkers) : _min(minWorkers), _max(maxWorkers) {}
+
+    /// @brief Цикл подстройки (для отдельного потока)
+    void run() {
+        Sample last = sample();
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(TUNER_INTERVAL_MS));
+            Sample now = sample();
+            step(last, now);
+            last = now;
+        }
+    }
+
+private:
+    /// @struct Sample
+    /// @brief Показания счётчиков в момент времени
+    struct Sample {
+        int64_t time;                ///< Монотонное время, нс
+        Scheduler::Stats scheduler;  ///< Счётчики планировщика
+        int64_t cpuNs;               ///< Процессорное время сервера
+        uint64_t hostIdle, hostTotal; ///< Тики простоя и всего по узлу
+        int64_t runningNs;           ///< Сколько уже идут задания, ещё не учтённые в busyNs
+    };
+
+    /// @brief Снять показания
+    ///
+    /// busyNs растёт только по завершении задания, поэтому к нему добавляется время
+    /// выполняемых заданий из слотов потоков: иначе задание дольше периода подстройки
+    /// выглядит как простой, и под долгой нагрузкой потоки убираются.
+    static Sample sample() {
+        Sample s{steadyNs(), scheduler.stats(), processCpuNs(), 0, 0, 0};
+        readHostCpu(s.hostIdle, s.hostTotal);
+        for (const Scheduler::JobInfo& job : scheduler.jobs()) s.runningNs += std::max<int64_t>(0, s.time - job.started);
+        return s;
+    }
+
+    /// @brief Одно решение по приращениям счётчиков за период
+    void step(const Sample& before, const Sample& after) {
+        static auto& workersGauge = metrics.counter("tuner.workers");
+        static auto& grows = metrics.counter("tuner.grows");
+        static auto& shrinks = metrics.counter("tuner.shrinks");
+        static auto& reverts = metrics.counter("tuner.reverts");
+        static auto& waitGauge = metrics.counter("tuner.queue_wait_us");
+        static auto& busyGauge = metrics.counter("tuner.busy_pct");
+        static auto& cpuGauge = metrics.counter("tuner.cpu_pct");
+        static auto& hostIdleGauge = metrics.counter("tuner.host_idle_pct");
+        static auto& throughputGauge = metrics.counter("tuner.jobs_per_min");
+
+        double seconds = (after.time - before.time) / 1e9;
+        unsigned workers = scheduler.workers();
+        uint64_t started = after.scheduler.started - before.scheduler.started;
+        int64_t busyNs = std::max<int64_t>(0, int64_t(after.scheduler.busyNs - before.scheduler.busyNs) +
+                                                   after.runningNs - before.runningNs);
+        uint64_t hostTotal = after.hostTotal - before.hostTotal;
+        double waitMs = started ? (after.scheduler.waitNs - before.scheduler.waitNs) / 1e6 / started : 0;
+        double busy = busyNs / (seconds * 1e9 * workers);
+        double cpu = busyNs ? double(after.cpuNs - before.cpuNs) / busyNs : 1;
+        double hostIdle = hostTotal ? double(after.hostIdle - before.hostIdle) / hostTotal : 1;
+        double throughput = (after.scheduler.completed - before.scheduler.completed) / seconds;
+        waitGauge = int64_t(waitMs * 1000);
+        busyGauge = int64_t(busy * 100);
+        cpuGauge = int64_t(cpu * 100);
+        hostIdleGauge = int64_t(hostIdle * 100);
+        throughputGauge = int64_t(throughput * 60);
+        workersGauge = workers;
+
+        if (_cooldown > 0) --_cooldown;
+        if (_grew) {
+            _grew = false;
+            if (throughput < 0.9 * _throughputBeforeGrow && workers > _min) {
+                scheduler.resize(workers - 1);
+                workersGauge = workers - 1;
+                ++reverts;
+                _cooldown = TUNER_COOLDOWN;
+                _streak = 0;
+                return;
+            }
+        }
+
+        bool saturated = hostIdle < TUNER_HOST_SATURATED;
+        int signal = 0;
+        if ((busy < TUNER_BUSY_LOW && waitMs < TUNER_GROW_WAIT_MS / 4) || (saturated && cpu < TUNER_CPU_STARVED))
+            signal = -1;
+        else if (waitMs > TUNER_GROW_WAIT_MS && busy > TUNER_BUSY_HIGH && !saturated && _cooldown == 0)
+            signal = 1;
+        _streak = signal && signal == _lastSignal ? _streak + 1 : (signal ? 1 : 0);
+        _lastSignal = signal;
+        if (_streak < TUNER_HYSTERESIS) return;
+        _streak = 0;
+        if (signal > 0 && workers < _max) {
+            _throughputBeforeGrow = throughput;
+            _grew = true;
+            scheduler.resize(workers + 1);
+            workersGauge = workers + 1;
+            ++grows;
+        } else if (signal < 0 && workers > _min) {
+            scheduler.resize(workers - 1);
+            workersGauge = workers - 1;
+            ++shrinks;
+        }
+    }
+
+    unsigned _min, _max;               ///< Границы числа потоков
+    int _lastSignal = 0;               ///< Сигнал прошлого периода: 1 — расти, -1 — сокращаться
+    int _streak = 0;                   ///< Сколько периодов подряд держится сигнал
+    int _cooldown = 0;                 ///< Сколько периодов ещё нельзя расти
+    bool _grew = false;                ///< В прошлом периоде добавлен поток
+    double _throughputBeforeGrow = 0;  ///< Пропускная способность до роста
+};
+
+/// @brief Снимок стека потока, запрошенный сторожевым потоком
+void* stallFrames[WATCHDOG_STACK_DEPTH];
+/// @brief Число кадров в снимке; -1 — снимок ещё не готов
+std::atomic<int> stallFrameCount{-1};
+
+/// @brief Обработчик SIGUSR2: снять стек прерванного потока
+void captureStack(int) {
+    stallFrameCount.store(backtrace(stallFrames, WATCHDOG_STACK_DEPTH), std::memory_order_release);
+}
+
+/// @brief Метка последней итерации цикла приёма соединений, нс
+std::atomic<int64_t> eventLoopBeat{0};
+
+/// @brief Записать в журнал зависшее задание: команда, время, начало запроса и стек потока
+void reportStall(unsigned worker, const Scheduler::JobInfo& job, int64_t elapsedMs) {
+    std::string input;
+    for (const auto& c : connections.list())
+        if (c->job == job.id) input = c->input();
+    std::ostringstream batch;
+    for (size_t i = 1; i < job.batch.size(); ++i) batch << " " << job.batch[i];
+    stallFrameCount.store(-1);
+    int frames = -1;
+    if (pthread_kill(scheduler.nativeHandle(worker), SIGUSR2) == 0) {
+        for (int i = 0; i < 100 && (frames = stallFrameCount.load(std::memory_order_acquire)) < 0; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::cerr << "STALL job " << job.id << " " << job.name << " vertices " << job.cost << " worker " << worker
+              << " running " << elapsedMs << " ms";
+    if (job.batch.size() > 1) std::cerr << " batch" << batch.str();
+    std::cerr << "\ninput: " << input << "\n";
+    if (frames > 0) backtrace_symbols_fd(stallFrames, frames, STDERR_FILENO);
+    std::cerr.flush();
+}
+
+/// @brief Сторожевой поток: зависшие задания и задержка цикла приёма соединений
+///
+/// Каждый вычислительный поток публикует время начала своего задания в слоте; задание,
+/// идущее дольше WATCHDOG_STALL_MS, один раз попадает в журнал со снимком стека.
+/// Цикл приёма соединений отмечает каждую итерацию (poll с таймаутом WATCHDOG_INTERVAL_MS),
+/// и отставание метки сверх ожидаемого периода — это его задержка.
+void watchdog() {
+    static auto& workerStalls = metrics.counter("watchdog.worker_stalls");
+    static auto& longestJob = metrics.counter("watchdog.longest_job_ms");
+    static auto& loopLag = metrics.counter("watchdog.event_loop_lag_ms");
+    static auto& loopLagMax = metrics.counter("watchdog.event_loop_lag_max_ms");
+    static auto& loopStalls = metrics.counter("watchdog.event_loop_stalls");
+    struct sigaction action{};
+    action.sa_handler = captureStack;
+    sigaction(SIGUSR2, &action, nullptr);
+    backtrace(stallFrames, 1); // первый вызов загружает libgcc, в обработчике сигнала этого делать нельзя
+
+    std::vector<uint64_t> reported(SCHEDULER_MAX_WORKERS, 0);
+    bool loopStalled = false;
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(WATCHDOG_INTERVAL_MS));
+        int64_t now = steadyNs();
+        int64_t longest = 0;
+        for (const Scheduler::JobInfo& job : scheduler.jobs()) {
+            int64_t elapsedMs = (now - job.started) / 1000000;
+            longest = std::max(longest, elapsedMs);
+            if (elapsedMs < WATCHDOG_STALL_MS || reported[job.worker] == job.id) continue;
+            reported[job.worker] = job.id;
+            ++workerStalls;
+            reportStall(job.worker, job, elapsedMs);
+        }
+        longestJob = longest;
+
+        int64_t lag = std::max<int64_t>(0, (now - eventLoopBeat.load()) / 1000000 - WATCHDOG_INTERVAL_MS);
+        loopLag = lag;
+        if (lag > loopLagMax) loopLagMax = lag;
+        if (lag >= WATCHDOG_LOOP_LAG_MS && !loopStalled) {
+            ++loopStalls;
+            std::cerr << "STALL event loop lag " << lag << " ms" << std::endl;
+        }
+        loopStalled = lag >= WATCHDOG_LOOP_LAG_MS;
+    }
+}
+
+/// @brief Ключ точки на кривой Гильберта порядка HILBERT_ORDER внутри охвата
+/// @param bounds Охват всех точек (вырожденный охват допустим)
+uint32_t hilbertKey(const BBox& bounds, double x, double y) {
+    const uint32_t side = (1u << HILBERT_ORDER) - 1;
+    double w = bounds.maxX - bounds.minX, h = bounds.maxY - bounds.minY;
+    uint32_t hx = w > 0 ? uint32_t(std::clamp((x - bounds.minX) / w, 0.0, 1.0) * side) : 0;
+    uint32_t hy = h > 0 ? uint32_t(std::clamp((y - bounds.minY) / h, 0.0, 1.0) * side) : 0;
+    uint32_t key = 0;
+    for (uint32_t s = 1u << (HILBERT_ORDER - 1); s > 0; s >>= 1) {
+        uint32_t rx = (hx & s) > 0, ry = (hy & s) > 0;
+        key += s * s * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                hx = side - hx;
+                hy = side - hy;
+            }
+            std::swap(hx, hy);
+        }
+    }
+    return key;
+}
+
+/// @brief Порядок обхода точек по кривой Гильберта
+/// @return Номера точек по возрастанию ключа (при равных ключах — в исходном порядке)
+std::vector<uint32_t> hilbertOrder(const std::vector<Point>& points) {
+    BBox bounds = boundingBox(points.data(), points.size());
+    std::vector<uint64_t> keyed(points.size());
+    for (size_t i = 0; i < points.size(); ++i)
+        keyed[i] = uint64_t(hilbertKey(bounds, points[i].x, points[i].y)) << 32 | i;
+    std::sort(keyed.begin(), keyed.end());
+    std::vector<uint32_t> order(keyed.size());
+    for (size_t i = 0; i < keyed.size(); ++i) order[i] = uint32_t(keyed[i]);
+    return order;
+}
+
+/// @class RTree
+/// @brief Упакованное R-дерево прямоугольников, построенное методом STR (Sort-Tile-Recursive)
+///
+/// Прямоугольники сортируются по центру по x, режутся на ~sqrt(n/M) вертикальных полос,
+/// внутри полосы сортируются по y и группируются по M; уровни выше строятся так же из
+/// прямоугольников узлов. Узлы лежат в одном массиве по уровням, корень последний;
+/// дерево неизменяемо и читается из многих потоков без блокировок.
+///
+/// Упаковка по Гильберту сортирует элементы один раз по ключу центра на кривой Гильберта
+/// и группирует подряд на всех уровнях: строится быстрее STR, что важно для индекса,
+/// который перестраивается на ходу.
+class RTree {
+public:
+    /// @brief Способ упаковки
+    enum class Packing { STR, Hilbert };
+
+    RTree() = default;
+
+    /// @brief Построить дерево
+    /// @param boxes Прямоугольники элементов; элемент — индекс в этом массиве
+    /// @param packing Способ упаковки
+    explicit RTree(std::vector<BBox> boxes, Packing packing = Packing::STR)
+        : _boxes(std::move(boxes)), _items(_boxes.size()) {
+        std::iota(_items.begin(), _items.end(), 0u);
+        if (packing == Packing::Hilbert) sortHilbert();
+        else sortTiles(_items.begin(), _items.end(), [&](uint32_t i) -> const BBox& { return _boxes[i]; });
+        addLevel(_items.size(), true, [&](size_t i) -> const BBox& { return _boxes[_items[i]]; });
+        for (size_t begin = 0; _nodes.size() - begin > 1;) {
+            size_t end = _nodes.size();
+            if (packing == Packing::STR)
+                sortTiles(_nodes.begin() + begin, _nodes.end(), [](const Node& n) -> const BBox& { return n.box; });
+            addLevel(end - begin, false, [&](size_t i) -> const BBox& { return _nodes[begin + i].box; }, begin);
+            begin = end;
+        }
+    }
+
+    /// @brief Число элементов
+    size_t size() const { return _items.size(); }
+
+    /// @brief Элементы, прямоугольники которых пересекают box (включая касание)
+    /// @param visit Вызывается с индексом элемента, порядок не определён
+    template <class Visit>
+    void query(const BBox& box, Visit&& visit) const {
+        if (_nodes.empty()) return;
+        std::vector<uint32_t> stack{uint32_t(_nodes.size() - 1)};
+        while (!stack.empty()) {
+            const Node& node = _nodes[stack.back()];
+            stack.pop_back();
+            if (!node.box.intersects(box)) continue;
+            for (uint32_t i = node.begin; i < node.end; ++i) {
+                if (!node.leaf) stack.push_back(i);
+                else if (_boxes[_items[i]].intersects(box)) visit(_items[i]);
+            }
+        }
+    }
+
+private:
+    /// @struct Node
+    /// @brief Узел: прямоугольник и диапазон потомков (узлов уровня ниже или элементов листа)
+    struct Node {
+        BBox box;           ///< Охват потомков
+        uint32_t begin;     ///< Первый потомок
+        uint32_t end;       ///< Конец потомков
+        bool leaf;          ///< Потомки — элементы
+    };
+
+    /// @brief Упорядочить диапазон по полосам STR
+    template <class It, class Box>
+    static void sortTiles(It first, It last, Box box) {
+        size_t n = last - first;
+        size_t slice = RTREE_NODE_CAPACITY *
+                       size_t(std::ceil(std::sqrt(double((n + RTREE_NODE_CAPACITY - 1) / RTREE_NODE_CAPACITY))));
+        auto byX = [&](const auto& a, const auto& b) { return box(a).minX + box(a).maxX < box(b).minX + box(b).maxX; };
+        auto byY = [&](const auto& a, const auto& b) { return box(a).minY + box(a).maxY < box(b).minY + box(b).maxY; };
+        std::sort(first, last, byX);
+        for (size_t i = 0; i < n; i += slice) std::sort(first + i, first + std::min(i + slice, n), byY);
+    }
+
+    /// @brief Упорядочить элементы по ключу Гильберта центров
+    void sortHilbert() {
+        std::vector<Point> centers;
+        centers.reserve(_boxes.size());
+        for (const BBox& b : _boxes) centers.emplace_back((b.minX + b.maxX) / 2, (b.minY + b.maxY) / 2);
+        _items = hilbertOrder(centers);
+    }
+
+    /// @brief Добавить уровень узлов над n упорядоченными потомками
+    /// @param offset Индекс первого потомка
+    template <class Box>
+    void addLevel(size_t n, bool leaf, Box box, size_t offset = 0) {
+        for (size_t i = 0; i < n; i += RTREE_NODE_CAPACITY) {
+            Node node{BBox(), uint32_t(offset + i), uint32_t(offset + std::min(i + RTREE_NODE_CAPACITY, n)), leaf};
+            for (size_t k = i; k < std::min(i + RTREE_NODE_CAPACITY, n); ++k) node.box.add(box(k));
+            _nodes.push_back(node);
+        }
+    }
+
+    std::vector<BBox> _boxes;     ///< Прямоугольники элементов
+    std::vector<uint32_t> _items; ///< Элементы в порядке листьев
+    std::vector<Node> _nodes;     ///< Узлы по уровням снизу вверх
+};
+
+/// @class BoxGrid
+/// @brief Равномерная сетка над прямоугольниками: в каждой ячейке — задевающие её прямоугольники
+///
+/// Списки ячеек лежат подряд (CSR); точка вне охвата сетки попадает в последнюю, пустую ячейку,
+/// так что поиск ячейки не ветвится. Прямоугольник, задевающий больше ZONE_GRID_MAX_CELLS
+/// ячеек, в сетку не копируется, а попадает в отдельное R-дерево больших: так размер сетки
+/// не больше ZONE_GRID_MAX_CELLS записей на прямоугольник при любом перекрытии.
+class BoxGrid {
+public:
+    BoxGrid() : _side(0), _scaleX(0), _scaleY(0), _start(2, 0) {}
+
+    /// @brief Построить сетку
+    /// @param boxes Прямоугольники; элемент — индекс в этом массиве
+    explicit BoxGrid(const std::vector<BBox>& boxes) : BoxGrid() {
+        if (boxes.empty()) return;
+        for (const BBox& b : boxes) _bounds.add(b);
+        _side = std::min(ZONE_GRID_MAX_SIDE, std::max<size_t>(1, size_t(std::ceil(std::sqrt(double(boxes.size()))))));
+        double w = _bounds.maxX - _bounds.minX, h = _bounds.maxY - _bounds.minY;
+        _scaleX = w > 0 ? _side / w : 0;
+        _scaleY = h > 0 ? _side / h : 0;
+        _start.assign(_side * _side + 2, 0);
+        auto cells = [&](const BBox& b) {
+            return (column(b.maxX) - column(b.minX) + 1) * (row(b.maxY) - row(b.minY) + 1);
+        };
+        auto forCells = [&](const BBox& b, auto&& fn) {
+            size_t x0 = column(b.minX), x1 = column(b.maxX), y0 = row(b.minY), y1 = row(b.maxY);
+            for (size_t y = y0; y <= y1; ++y)
+                for (size_t x = x0; x <= x1; ++x) fn(y * _side + x);
+        };
+        std::vector<BBox> large;
+        for (uint32_t i = 0; i < boxes.size(); ++i) {
+            if (cells(boxes[i]) <= ZONE_GRID_MAX_CELLS) {
+                forCells(boxes[i], [&](size_t c) { ++_start[c + 2]; });
+            } else {
+                _large.push_back(i);
+                large.push_back(boxes[i]);
+            }
+        }
+        std::partial_sum(_start.begin(), _start.end(), _start.begin());
+        _items.resize(_start.back());
+        for (uint32_t i = 0; i < boxes.size(); ++i)
+            if (cells(boxes[i]) <= ZONE_GRID_MAX_CELLS) forCells(boxes[i], [&](size_t c) { _items[_start[c + 1]++] = i; });
+        _largeTree = RTree(std::move(large));
+    }
+
+    /// @brief Ячейка точки (пустая, если точка вне охвата)
+    size_t cell(double x, double y) const {
+        bool outside = !(x >= _bounds.minX && x <= _bounds.maxX && y >= _bounds.minY && y <= _bounds.maxY);
+        return outside ? _side * _side : row(y) * _side + column(x);
+    }
+
+    /// @brief Начало списка ячейки
+    const uint32_t* begin(size_t cell) const { return _items.data() + _start[cell]; }
+    /// @brief Конец списка ячейки
+    const uint32_t* end(size_t cell) const { return _items.data() + _start[cell + 1]; }
+
+    /// @brief Есть ли большие прямоугольники вне сетки
+    bool hasLarge() const { return !_large.empty(); }
+
+    /// @brief Большие прямоугольники, содержащие точку
+    /// @param visit Вызывается с индексом прямоугольника, порядок не определён
+    template <class Visit>
+    void visitLarge(double x, double y, Visit&& visit) const {
+        BBox point;
+        point.add(Point(x, y));
+        _largeTree.query(point, [&](uint32_t i) { visit(_large[i]); });
+    }
+
+private:
+    /// @brief Столбец координаты x внутри охвата
+    size_t column(double x) const { return std::min(_side - 1, size_t((x - _bounds.minX) * _scaleX)); }
+    /// @brief Строка координаты y внутри охвата
+    size_t row(double y) const { return std::min(_side - 1, size_t((y - _bounds.minY) * _scaleY)); }
+
+    BBox _bounds;                 ///< Охват сетки
+    size_t _side;                 ///< Ячеек по стороне
+    double _scaleX, _scaleY;      ///< Ячеек на единицу длины
+    std::vector<size_t> _start;   ///< Начала списков ячеек (плюс пустая ячейка "вне")
+    std::vector<uint32_t> _items; ///< Списки ячеек подряд
+    std::vector<uint32_t> _large; ///< Прямоугольники, не попавшие в сетку
+    RTree _largeTree;             ///< Индекс больших прямоугольников
+};
+
+/// @struct ConvexLocator
+/// @brief Выпуклый многоугольник, подготовленный к проверке точки за O(log n)
+///
+/// Вершины хранятся по часовой стрелке, как в Polygon. Точка внутри, если она не слева
+/// ни от одного ребра, по той же формуле, что Point::classify: точки границы — внутри,
+/// как и при отсечении. Веер из первой вершины делится пополам двоичным поиском,
+/// и проверяется только ребро найденного сектора.
+struct ConvexLocator {
+    std::vector<Point> cw; ///< Вершины по часовой стрелке
+
+    /// @brief Подготовить выпуклый план
+    explicit ConvexLocator(const ClipPlan& plan) : cw(plan.vertices) {
+        if (plan.reversed) std::reverse(cw.begin(), cw.end());
+    }
+
+    /// @brief Точка строго слева от ребра o->d (как LEFT у Point::classify)
+    static bool left(const Point& o, const Point& d, double x, double y) {
+        return (d.x - o.x) * (y - o.y) - (x - o.x) * (d.y - o.y) > 0;
+    }
+
+    /// @brief Точка внутри или на границе
+    bool contains(double x, double y) const {
+        size_t n = cw.size();
+        if (n < 3 || left(cw[0], cw[1], x, y) || left(cw[n - 1], cw[0], x, y)) return false;
+        size_t lo = 1, hi = n - 1;
+        while (hi - lo > 1) {
+            size_t mid = (lo + hi) / 2;
+            if (left(cw[0], cw[mid], x, y)) hi = mid;
+            else lo = mid;
+        }
+        return !left(cw[lo], cw[lo + 1], x, y);
+    }
+};
+
+/// @struct RegisteredWindow
+/// @brief Зарегистрированное окно отсечения с кешированным выпуклым разбиением
+struct RegisteredWindow {
+    BBox box;                                            ///< Охват окна
+    std::shared_ptr<const ClipPlan> plan;                ///< План окна целиком
+    std::vector<std::shared_ptr<const ClipPlan>> pieces; ///< Планы выпуклых частей
+    std::vector<ConvexLocator> locators;                 ///< Поиск точки в выпуклых частях
+};
+
+/// @brief Подготовить окно: нормализовать ориентацию и разбить на выпуклые части
+/// @param points Вершины окна в любом направлении обхода
+/// @throws std::runtime_error для вырожденных и непростых окон
+std::shared_ptr<const RegisteredWindow> prepareWindow(const std::vector<Point>& points) {
+    auto window = std::make_shared<RegisteredWindow>();
+    window->plan = std::make_shared<const ClipPlan>(points);
+    if (!window->plan->valid()) throw std::runtime_error("Degenerate window");
+    window->box = boundingBox(points.data(), points.size());
+    std::vector<Point> ccw(points);
+    if (!window->plan->reversed) std::reverse(ccw.begin(), ccw.end());
+    if (isConvex(ccw)) {
+        window->pieces.push_back(window->plan);
+    } else {
+        for (const auto& piece : decomposeConvex(ccw)) {
+            std::vector<Point> vertices;
+            for (int i : piece) vertices.push_back(ccw[i]);
+            window->pieces.push_back(std::make_shared<const ClipPlan>(vertices));
+        }
+    }
+    for (const auto& piece : window->pieces) window->locators.emplace_back(*piece);
+    return window;
+}
+
+/// @class WindowRegistry
+/// @brief Зарегистрированные окна отсечения по идентификаторам с пространственным индексом
+///
+/// Индекс — неизменяемый снимок (R-дерево с упаковкой по Гильберту) и список окон,
+/// зарегистрированных после снимка. Фоновый поток строит новый снимок, когда список
+/// дорастает до WINDOW_INDEX_MIN_PENDING и 1/16 снимка либо простоял WINDOW_INDEX_DELAY_MS,
+/// и подменяет указатель под блокировкой вместе с очисткой списка. Поиск берёт указатель
+/// и подходящие новые окна под блокировкой, а обходит дерево уже без неё. Кроме дерева
+/// снимок держит равномерную сетку охватов для поиска точек.
+class WindowRegistry {
+public:
+    /// @brief Окно с идентификатором
+    typedef std::pair<uint64_t, std::shared_ptr<const RegisteredWindow>> Entry;
+
+    WindowRegistry() : _next(1), _index(std::make_shared<const Snapshot>()), _stop(false),
+                       _rebuilds(metrics.counter("windows.index_rebuilds")),
+                       _rebuilder([this]() { rebuildLoop(); }) {}
+
+    /// @brief Деструктор: останавливает фоновую перестройку
+    ~WindowRegistry() {
+        {
+            LOCK(lock, _mutex);
+            _stop = true;
+        }
+        _cv.notify_all();
+        _rebuilder.join();
+    }
+
+    /// @brief Зарегистрировать окно
+    /// @return Идентификатор окна
+    uint64_t add(std::shared_ptr<const RegisteredWindow> window) {
+        LOCK(lock, _mutex);
+        uint64_t id = _next++;
+        _windows[id] = window;
+        _pending.emplace_back(id, window);
+        if (rebuildDue()) _cv.notify_one();
+        return id;
+    }
+
+    /// @brief Найти окно
+    /// @return nullptr если окно не зарегистрировано
+    std::shared_ptr<const RegisteredWindow> find(uint64_t id) {
+        LOCK(lock, _mutex);
+        auto it = _windows.find(id);
+        return it == _windows.end() ? nullptr : it->second;
+    }
+
+    /// @struct Snapshot
+    /// @brief Проиндексированные окна
+    struct Snapshot {
+        std::vector<Entry> windows; ///< Окна по возрастанию идентификатора; элемент индексов — номер здесь
+        RTree tree;                 ///< R-дерево охватов
+        BoxGrid grid;               ///< Сетка охватов
+    };
+
+    /// @brief Текущий снимок индекса
+    /// @param[out] pending Окна, зарегистрированные после снимка (идентификаторы больше снимка)
+    std::shared_ptr<const Snapshot> snapshot(std::vector<Entry>& pending) {
+        LOCK(lock, _mutex);
+        pending = _pending;
+        return _index;
+    }
+
+    /// @brief Окна, охват которых пересекает box, по возрастанию идентификатора
+    std::vector<Entry> candidates(const BBox& box) {
+        std::vector<Entry> result;
+        std::shared_ptr<const Snapshot> index;
+        {
+            LOCK(lock, _mutex);
+            index = _index;
+            for (const Entry& e : _pending)
+                if (e.second->box.intersects(box)) result.push_back(e);
+        }
+        index->tree.query(box, [&](uint32_t i) { result.push_back(index->windows[i]); });
+        std::sort(result.begin(), result.end(), [](const Entry& a, const Entry& b) { return a.first < b.first; });
+        return result;
+    }
+
+private:
+    /// @brief Пора ли перестраивать индекс, не дожидаясь паузы (под _mutex)
+    bool rebuildDue() const {
+        return _pending.size() >= std::max(WINDOW_INDEX_MIN_PENDING, _index->windows.size() / 16);
+    }
+
+    /// @brief Построить снимок по окнам
+    /// @throws std::bad_alloc и другие ошибки построения
+    static std::shared_ptr<const Snapshot> buildSnapshot(std::vector<Entry> windows) {
+        auto snapshot = std::make_shared<Snapshot>();
+        snapshot->windows = std::move(windows);
+        std::sort(snapshot->windows.begin(), snapshot->windows.end(),
+                  [](const Entry& a, const Entry& b) { return a.first < b.first; });
+        std::vector<BBox> boxes;
+        boxes.reserve(snapshot->windows.size());
+        for (const Entry& e : snapshot->windows) boxes.push_back(e.second->box);
+        snapshot->grid = BoxGrid(boxes);
+        snapshot->tree = RTree(std::move(boxes), RTree::Packing::Hilbert);
+        return snapshot;
+    }
+
+    /// @brief Фоновая перестройка индекса
+    ///
+    /// Ошибка построения (например, нехватка памяти) не трогает текущий снимок и список
+    /// новых окон: поиск продолжает работать по ним, а попытка повторяется после паузы.
+    void rebuildLoop() {
+        static auto& failures = metrics.counter("windows.rebuild_failed");
+        bool failed = false;
+        LOCK(lock, _mutex);
+        while (!_stop) {
+            _cv.wait_for(lock, std::chrono::milliseconds(WINDOW_INDEX_DELAY_MS),
+                         [&]() { return _stop || (!failed && rebuildDue()); });
+            if (_stop || _pending.empty()) continue;
+            std::vector<Entry> windows;
+            try {
+                windows.assign(_windows.begin(), _windows.end());
+            } catch (...) {
+                failed = true;
+                ++failures;
+                continue;
+            }
+            uint64_t next = _next;
+            lock.unlock();
+
+            std::shared_ptr<const Snapshot> snapshot;
+            try {
+                snapshot = buildSnapshot(std::move(windows));
+                ++_rebuilds;
+            } catch (...) {
+                ++failures;
+            }
+
+            lock.lock();
+            failed = !snapshot;
+            if (failed) continue;
+            _index = std::move(snapshot);
+            _pending.erase(std::remove_if(_pending.begin(), _pending.end(),
+                                          [&](const Entry& e) { return e.first < next; }),
+                           _pending.end());
+        }
+    }
+
+    uint64_t _next;    ///< Следующий идентификатор
+    std::unordered_map<uint64_t, std::shared_ptr<const RegisteredWindow>> _windows; ///< Окна
+    std::shared_ptr<const Snapshot> _index; ///< Текущий снимок индекса
+    std::vector<Entry> _pending;            ///< Окна, зарегистрированные после снимка
+    std::mutex _mutex;                      ///< Доступ из потоков транспортов
+    ServerCondition _cv;                    ///< Сигнал фоновому потоку
+    bool _stop;                             ///< Флаг остановки
+    std::atomic<int64_t>& _rebuilds;        ///< Счётчик перестроек
+    std::thread _rebuilder;                 ///< Фоновый поток перестройки
+};
+
+/// @brief Общий реестр окон сервера
+WindowRegistry windowRegistry;
+
+/// @brief Отсечь многоугольник зарегистрированным окном
+/// @param subject Вершины исходного многоугольника
+/// @param window Окно с выпуклым разбиением
+/// @return Кольца результата (пусто, если пересечения нет)
+///
+/// Каждая выпуклая часть отсекается быстрым выпуклым путём, большие задания —
+/// параллельно; результаты частей склеиваются по общим диагоналям.
+std::vector<std::vector<Point>> clipToWindow(const std::vector<Point>& subject, const RegisteredWindow& window) {
+    size_t n = window.pieces.size();
+    std::vector<std::vector<Point>> parts(n);
+    std::vector<char> nonEmpty(n, 0);
+    auto clipPiece = [&](size_t i) { nonEmpty[i] = clipConvex(subject, *window.pieces[i], parts[i]); };
+    if (n > 1 && subject.size() * n >= PARALLEL_MIN_WORK) workerPool.parallelFor(n, clipPiece);
+    else for (size_t i = 0; i < n; ++i) clipPiece(i);
+
+    std::vector<std::vector<Point>> rings;
+    for (size_t i = 0; i < n; ++i)
+        if (nonEmpty[i]) rings.push_back(std::move(parts[i]));
+    if (rings.size() > 1) rings = mergePieces(rings);
+    return rings;
+}
+
+/// @brief Пересекает ли субъект выпуклый план (касание считается пересечением)
+///
+/// Дешёвые проверки идут первыми: все вершины снаружи одного ребра — нет, какая-то
+/// вершина внутри всех рёбер — да; иначе решает отсечение.
+bool intersectsConvex(const std::vector<Point>& subject, const ClipPlan& plan) {
+    for (size_t k = 0; k < plan.size(); ++k)
+        if (std::none_of(subject.begin(), subject.end(), [&](const Point& v) {
+                return plan.a[k] * v.x + plan.b[k] * v.y + plan.c[k] <= 0;
+            }))
+            return false;
+    for (const Point& v : subject) {
+        size_t k = 0;
+        while (k < plan.size() && plan.a[k] * v.x + plan.b[k] * v.y + plan.c[k] <= 0) ++k;
+        if (k == plan.size()) return true;
+    }
+    std::vector<Point> clipped;
+    return clipConvex(subject, plan, clipped);
+}
+
+/// @struct PlanSubset
+/// @brief Часть рёбер плана, которые действительно пересекают субъект (для clipConvex)
+struct PlanSubset {
+    std::vector<double> a, b, c; ///< Коэффициенты выбранных рёбер
+
+    /// @brief Число рёбер
+    size_t size() const { return a.size(); }
+
+    /// @brief Пустой набор рёбер — тождественное отсечение, оно допустимо
+    bool valid() const { return true; }
+};
+
+/// @brief Отсечь один субъект несколькими окнами за один проход по субъекту
+/// @param subject Вершины субъекта
+/// @param plans Планы окон
+/// @return Результат для каждого окна по порядку (пустой, если пересечения нет)
+///
+/// Коэффициенты рёбер всех окон лежат подряд (SoA), и каждая вершина субъекта
+/// классифицируется относительно всех рёбер сразу во внутреннем векторизуемом цикле.
+/// По счётчикам "вершин внутри" окно отбрасывается (все вершины вне одного ребра),
+/// принимается целиком (все внутри всех рёбер) или отсекается только рёбрами,
+/// которые субъект пересекает: ребро, внутри которого лежат все исходные вершины,
+/// не меняет и результат предыдущих этапов, лежащий в выпуклой оболочке субъекта.
+std::vector<std::vector<Point>> clipMany(const std::vector<Point>& subject, const std::vector<std::shared_ptr<const ClipPlan>>& plans) {
+    std::vector<double> a, b, c;
+    std::vector<size_t> offsets{0};
+    for (const auto& plan : plans) {
+        a.insert(a.end(), plan->a.begin(), plan->a.end());
+        b.insert(b.end(), plan->b.begin(), plan->b.end());
+        c.insert(c.end(), plan->c.begin(), plan->c.end());
+        offsets.push_back(a.size());
+    }
+    size_t edges = a.size();
+    std::vector<uint32_t> inside(edges, 0);
+    for (const Point& v : subject) {
+        double x = v.x, y = v.y;
+        for (size_t e = 0; e < edges; ++e) inside[e] += (a[e] * x + b[e] * y + c[e] <= 0);
+    }
+
+    size_t n = subject.size();
+    std::vector<std::vector<Point>> results(plans.size());
+    std::vector<size_t> straddling;
+    std::vector<PlanSubset> subsets(plans.size());
+    for (size_t w = 0; w < plans.size(); ++w) {
+        if (!plans[w]->valid() || n == 0) continue;
+        bool rejected = false;
+        for (size_t e = offsets[w]; e < offsets[w + 1]; ++e) {
+            if (inside[e] == 0) rejected = true;
+            if (inside[e] == n) continue;
+            subsets[w].a.push_back(a[e]);
+            subsets[w].b.push_back(b[e]);
+            subsets[w].c.push_back(c[e]);
+        }
+        if (rejected) continue;
+        if (subsets[w].size() == 0) results[w] = subject;
+        else straddling.push_back(w);
+    }
+
+    auto clipWindow = [&](size_t i) {
+        size_t w = straddling[i];
+        if (!clipConvex(subject, subsets[w], results[w])) results[w].clear();
+    };
+    if (straddling.size() > 1 && n * straddling.size() >= PARALLEL_MIN_WORK)
+        workerPool.parallelFor(straddling.size(), clipWindow);
+    else for (size_t i = 0; i < straddling.size(); ++i) clipWindow(i);
+    return results;
+}
+
+/// @brief Набор колец: внешние против часовой стрелки, дыры по часовой
+typedef std::vector<std::vector<Point>> Rings;
+
+/// @brief Ограничивающий прямоугольник набора колец
+BBox boundingBox(const Rings& rings) {
+    BBox box;
+    for (const auto& ring : rings)
+        for (const Point& v : ring) box.add(v);
+    return box;
+}
+
+/// @class RingIndex
+/// @brief Число оборотов набора колец вокруг точки с разбиением рёбер по полосам Y
+class RingIndex {
+public:
+    /// @brief Построить индекс
+    /// @param rings Кольца
+    explicit RingIndex(const Rings& rings) {
+        size_t edges = 0;
+        for (const auto& ring : rings) {
+            edges += ring.size();
+            for (const Point& v : ring) {
+                _minY = std::min(_minY, v.y);
+                _maxY = std::max(_maxY, v.y);
+            }
+        }
+        size_t rows = std::max<size_t>(1, (size_t)std::sqrt((double)edges));
+        _height = (_maxY - _minY) / rows;
+        if (!(_height > 0)) rows = 1, _height = 1;
+        _rows.resize(rows);
+        for (const auto& ring : rings) {
+            for (size_t i = 0; i < ring.size(); ++i) {
+                Edge e(ring[i], ring[(i + 1) % ring.size()]);
+                size_t lo = row(std::min(e.org.y, e.dest.y)), hi = row(std::max(e.org.y, e.dest.y));
+                for (size_t r = lo; r <= hi; ++r) _rows[r].push_back(e);
+            }
+        }
+    }
+
+    /// @brief Число оборотов вокруг точки (0 — точка снаружи)
+    int winding(const Point& p) const {
+        if (p.y < _minY || p.y > _maxY) return 0;
+        int w = 0;
+        for (const Edge& e : _rows[row(p.y)]) {
+            if (e.org.y <= p.y) {
+                if (e.dest.y > p.y && cross(e.org, e.dest, p) > 0) ++w;
+            } else if (e.dest.y <= p.y && cross(e.org, e.dest, p) < 0) {
+                --w;
+            }
+        }
+        return w;
+    }
+
+private:
+    /// @brief Номер полосы для координаты Y
+    size_t row(double y) const {
+        double r = std::floor((y - _minY) / _height);
+        return (size_t)std::min(std::max(r, 0.0), (double)(_rows.size() - 1));
+    }
+
+    double _minY = INFINITY, _maxY = -INFINITY; ///< Диапазон Y
+    double _height = 1;                          ///< Высота полосы
+    std::vector<std::vector<Edge>> _rows;        ///< Рёбра по полосам
+};
+
+/// @brief Объединение двух наборов колец
+/// @param first Первый набор (согласованная ориентация, без самопересечений)
+/// @param second Второй набор
+/// @return Кольца объединения
+///
+/// Пересечения рёбер разных наборов ищутся заметающей прямой по X, рёбра делятся в
+/// точках пересечения, затем остаются рёбра, не лежащие внутри другого набора.
+/// Совпадающие рёбра сохраняются один раз при одинаковом направлении и уничтожаются
+/// при противоположном. Оставшиеся рёбра сшиваются в кольца.
+Rings unionRings(const Rings& first, const Rings& second) {
+    if (!boundingBox(first).intersects(boundingBox(second))) {
+        Rings rings(first);
+        rings.insert(rings.end(), second.begin(), second.end());
+        return rings;
+    }
+
+    struct Segment {
+        Point a, b;
+        int set;
+        std::vector<double> cuts;
+    };
+    std::vector<Segment> segments;
+    const Rings* sets[2] = {&first, &second};
+    for (int k = 0; k < 2; ++k)
+        for (const auto& ring : *sets[k])
+            for (size_t i = 0; i < ring.size(); ++i)
+                segments.push_back({ring[i], ring[(i + 1) % ring.size()], k, {}});
+
+    Rings all(first);
+    all.insert(all.end(), second.begin(), second.end());
+    SnapGrid grid(all);
+    double eps = grid.eps;
+
+    // Заметающая прямая: активны отрезки, чей X-диапазон накрывает текущий
+    std::vector<size_t> order(segments.size()), active;
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    auto minX = [&](size_t i) { return std::min(segments[i].a.x, segments[i].b.x); };
+    auto maxX = [&](size_t i) { return std::max(segments[i].a.x, segments[i].b.x); };
+    std::sort(order.begin(), order.end(), [&](size_t i, size_t j) { return minX(i) < minX(j); });
+    for (size_t i : order) {
+        Segment& s = segments[i];
+        active.erase(std::remove_if(active.begin(), active.end(),
+                                    [&](size_t j) { return maxX(j) < minX(i) - eps; }), active.end());
+        for (size_t j : active) {
+            Segment& t = segments[j];
+            if (t.set == s.set) continue;
+            if (std::max(s.a.y, s.b.y) < std::min(t.a.y, t.b.y) - eps ||
+                std::max(t.a.y, t.b.y) < std::min(s.a.y, s.b.y) - eps) continue;
+            Point d1 = s.b - s.a, d2 = t.b - t.a, w = t.a - s.a;
+            double denom = d1.x * d2.y - d1.y * d2.x;
+            double len1 = d1.length(), len2 = d2.length();
+            if (std::abs(denom) > eps * len1 * len2) {
+                double u = (w.x * d2.y - w.y * d2.x) / denom;
+                double v = (w.x * d1.y - w.y * d1.x) / denom;
+                if (u >= 0 && u <= 1 && v >= 0 && v <= 1) {
+                    s.cuts.push_back(u);
+                    t.cuts.push_back(v);
+                }
+            } else if (std::abs(w.x * d1.y - w.y * d1.x) <= eps * len1) {
+                // Коллинеарные отрезки: концы каждого делят другой
+                auto project = [](const Point& p, const Point& o, const Point& d) {
+                    return ((p.x - o.x) * d.x + (p.y - o.y) * d.y) / (d.x * d.x + d.y * d.y);
+                };
+                for (const Point& p : {t.a, t.b}) {
+                    double u = project(p, s.a, d1);
+                    if (u > 0 && u < 1) s.cuts.push_back(u);
+                }
+                for (const Point& p : {s.a, s.b}) {
+                    double v = project(p, t.a, d2);
+                    if (v > 0 && v < 1) t.cuts.push_back(v);
+                }
+            }
+        }
+        active.push_back(i);
+    }
+
+    typedef SnapGrid::Key Key;
+    std::vector<std::pair<Key, Key>> pieces[2];
+    for (Segment& s : segments) {
+        std::sort(s.cuts.begin(), s.cuts.end());
+        Key from = grid.snap(s.a);
+        for (double u : s.cuts) {
+            Key to = grid.snap(Point(s.a.x + u * (s.b.x - s.a.x), s.a.y + u * (s.b.y - s.a.y)));
+            if (to != from) pieces[s.set].push_back({from, to});
+            from = to;
+        }
+        Key to = grid.snap(s.b);
+        if (to != from) pieces[s.set].push_back({from, to});
+    }
+
+    std::set<std::pair<Key, Key>> edgesOf[2];
+    for (int k = 0; k < 2; ++k) edgesOf[k].insert(pieces[k].begin(), pieces[k].end());
+    RingIndex index[2] = {RingIndex(first), RingIndex(second)};
+    std::multimap<Key, Key> outgoing;
+    for (int k = 0; k < 2; ++k) {
+        const auto& other = edgesOf[1 - k];
+        for (const auto& e : pieces[k]) {
+            bool same = other.count(e) > 0, opposite = other.count({e.second, e.first}) > 0;
+            if (opposite) continue;
+            if (same) {
+                if (k == 0) outgoing.emplace(e.first, e.second);
+                continue;
+            }
+            const Point& a = grid.points[e.first];
+            const Point& b = grid.points[e.second];
+            if (index[1 - k].winding(Point((a.x + b.x) / 2, (a.y + b.y) / 2)) == 0)
+                outgoing.emplace(e.first, e.second);
+        }
+    }
+    return stitchRings(outgoing, grid);
+}
+
+/// @brief Каскадное объединение многоугольников
+/// @param polygons Исходные многоугольники (любая ориентация, без самопересечений)
+/// @return Кольца объединения
+///
+/// Многоугольники упорядочиваются по центру прямоугольника, чтобы соседи объединялись
+/// раньше, затем сливаются попарно уровнями двоичного дерева; узлы одного уровня
+/// считаются параллельно. Непересекающиеся прямоугольники сливаются без вычислений.
+Rings cascadedUnion(std::vector<std::vector<Point>> polygons) {
+    std::vector<Rings> level;
+    std::vector<double> centers;
+    for (auto& poly : polygons) {
+        double area = signedArea(poly);
+        if (area == 0) continue;
+        if (area < 0) std::reverse(poly.begin(), poly.end());
+        level.push_back(Rings{std::move(poly)});
+    }
+    std::sort(level.begin(), level.end(), [](const Rings& a, const Rings& b) {
+        BBox p = boundingBox(a), q = boundingBox(b);
+        return p.minX + p.maxX < q.minX + q.maxX;
+    });
+    while (level.size() > 1) {
+        std::vector<Rings> next((level.size() + 1) / 2);
+        auto merge = [&](size_t i) {
+            next[i] = 2 * i + 1 < level.size() ? unionRings(level[2 * i], level[2 * i + 1]) : std::move(level[2 * i]);
+        };
+        if (next.size() > 1) workerPool.parallelFor(next.size(), merge);
+        else merge(0);
+        level.swap(next);
+    }
+    return level.empty() ? Rings() : level[0];
+}
+
+/// @struct RankedPoint
+/// @brief Вершина с порогом упрощения: вершина сохраняется при допуске не больше significance
+struct RankedPoint {
+    Point p;             ///< Координаты
+    double significance; ///< Отклонение, при котором вершина исчезает при упрощении
+};
+
+/// @brief Ранжировать вершины кольца по Дугласу-Пекеру один раз для всех допусков
+/// @param ring Вершины кольца
+/// @return Вершины с порогами: фильтр significance >= tol совпадает с упрощением с допуском tol
+///
+/// Порог вершины — расстояние, на котором она делит отрезок в рекурсии Дугласа-Пекера,
+/// ограниченное порогом родительской вершины, так что пороги монотонны по рекурсии.
+std::vector<RankedPoint> rankVertices(const std::vector<Point>& ring) {
+    size_t n = ring.size();
+    std::vector<RankedPoint> ranked(n);
+    for (size_t i = 0; i < n; ++i) ranked[i] = {ring[i], 0};
+    if (n < 4) {
+        for (auto& v : ranked) v.significance = INFINITY;
+        return ranked;
+    }
+    // Опорные вершины: первая и самая дальняя от неё
+    size_t far = 0;
+    for (size_t i = 1; i < n; ++i)
+        if ((ring[i] - ring[0]).norm2() > (ring[far] - ring[0]).norm2()) far = i;
+    ranked[0].significance = ranked[far].significance = INFINITY;
+
+    struct Span { size_t from, to; double limit; };
+    std::vector<Span> stack{{0, far, INFINITY}, {far, n, INFINITY}};
+    while (!stack.empty()) {
+        Span s = stack.back();
+        stack.pop_back();
+        if (s.to - s.from < 2) continue;
+        const Point& a = ring[s.from];
+        const Point& b = ring[s.to % n];
+        double len = (b - a).length();
+        size_t best = s.from + 1;
+        double bestDist = -1;
+        for (size_t i = s.from + 1; i < s.to; ++i) {
+            double d = len > 0 ? std::abs(cross(a, b, ring[i])) / len : (ring[i] - a).length();
+            if (d > bestDist) bestDist = d, best = i;
+        }
+        double sig = std::min(bestDist, s.limit);
+        ranked[best].significance = sig;
+        stack.push_back({s.from, best, sig});
+        stack.push_back({best, s.to, sig});
+    }
+    return ranked;
+}
+
+/// @brief Отсечь ранжированное кольцо прямоугольником; точки пересечения не упрощаются
+bool clipToBox(const std::vector<RankedPoint>& subject, const BBox& box, std::vector<RankedPoint>& result) {
+    std::vector<RankedPoint> in(subject), out;
+    for (int k = 0; k < 4; ++k) {
+        // Расстояние за границу: > 0 — снаружи
+        auto dist = [&](const Point& v) {
+            switch (k) {
+                case 0: return box.minX - v.x;
+                case 1: return v.x - box.maxX;
+                case 2: return box.minY - v.y;
+                default: return v.y - box.maxY;
+            }
+        };
+        out.clear();
+        for (size_t i = 0; i < in.size(); ++i) {
+            const RankedPoint& org = in[i];
+            const RankedPoint& dest = in[(i + 1) % in.size()];
+            double dOrg = dist(org.p), dDest = dist(dest.p);
+            bool orgInside = dOrg <= 0, destInside = dDest <= 0;
+            if (orgInside != destInside) {
+                double t = dOrg / (dOrg - dDest);
+                out.push_back({Point(org.p.x + t * (dest.p.x - org.p.x), org.p.y + t * (dest.p.y - org.p.y)), INFINITY});
+            }
+            if (destInside) out.push_back(dest);
+        }
+        if (out.empty()) return false;
+        in.swap(out);
+    }
+    result.swap(in);
+    return true;
+}
+
+/// @struct Tile
+/// @brief Тайл пирамиды с геометрией полного разрешения, отсечённой по тайлу
+struct Tile {
+    int z, x, y;                      ///< Уровень и номер тайла
+    std::vector<RankedPoint> geometry; ///< Отсечённый субъект с порогами упрощения
+};
+
+/// @brief Построить пирамиду тайлов
+/// @param subject Субъект
+/// @param bounds Охват тайла уровня 0
+/// @param minZoom Первый выдаваемый уровень
+/// @param maxZoom Последний уровень
+/// @return Выдаваемые тайлы с упрощённой геометрией, по уровням
+/// @throws std::runtime_error если число тайлов превышает PYRAMID_MAX_TILES
+///
+/// Вершины ранжируются один раз, и упрощение уровня — это фильтр по порогу с допуском
+/// в один пиксель тайла (PYRAMID_TILE_PIXELS на сторону). Каждый тайл отсекается из
+/// геометрии родителя полного разрешения, а не из всего субъекта; тайлы уровня
+/// считаются параллельно, пустые тайлы не порождают детей.
+std::vector<Tile> buildPyramid(const std::vector<Point>& subject, const BBox& bounds, int minZoom, int maxZoom) {
+    std::vector<Tile> level(1), output;
+    level[0] = {0, 0, 0, {}};
+    if (!clipToBox(rankVertices(subject), bounds, level[0].geometry)) return output;
+    size_t total = 1;
+    for (int z = 0; z <= maxZoom; ++z) {
+        double tileWidth = (bounds.maxX - bounds.minX) / (1 << z);
+        double tolerance = tileWidth / PYRAMID_TILE_PIXELS;
+        if (z >= minZoom) {
+            for (const Tile& tile : level) {
+                Tile simplified{tile.z, tile.x, tile.y, {}};
+                for (const RankedPoint& v : tile.geometry)
+                    if (v.significance >= tolerance) simplified.geometry.push_back(v);
+                if (simplified.geometry.size() >= 3) output.push_back(std::move(simplified));
+            }
+        }
+        if (z == maxZoom) break;
+
+        total += 4 * level.size();
+        if (total > PYRAMID_MAX_TILES) throw std::runtime_error("Too many tiles");
+        std::vector<Tile> children(4 * level.size());
+        std::vector<char> nonEmpty(children.size(), 0);
+        double width = tileWidth / 2, height = (bounds.maxY - bounds.minY) / (2 << z);
+        auto clipChild = [&](size_t i) {
+            const Tile& parent = level[i / 4];
+            Tile& child = children[i];
+            child.z = z + 1;
+            child.x = 2 * parent.x + (i & 1);
+            child.y = 2 * parent.y + ((i >> 1) & 1);
+            BBox box;
+            box.add(Point(bounds.minX + child.x * width, bounds.minY + child.y * height));
+            box.add(Point(bounds.minX + (child.x + 1) * width, bounds.minY + (child.y + 1) * height));
+            nonEmpty[i] = clipToBox(parent.geometry, box, child.geometry);
+        };
+        workerPool.parallelFor(children.size(), clipChild);
+        level.clear();
+        for (size_t i = 0; i < children.size(); ++i)
+            if (nonEmpty[i]) level.push_back(std::move(children[i]));
+    }
+    return output;
+}
+
+/// @class TileEncoder
+/// @brief Приёмник вершин, сразу кодирующий кольцо в команды векторного тайла
+///
+/// Вершины квантуются в целочисленные координаты тайла [0, extent] (ось Y вниз),
+/// повторы после квантования отбрасываются, а кольцо записывается командами
+/// MoveTo / LineTo / ClosePath с разностями в зигзаг-кодировании. Внешнее кольцо
+/// выводится с положительной площадью в координатах тайла, как требует формат.
+class TileEncoder {
+public:
+    /// @brief Конструктор
+    /// @param box Охват тайла
+    /// @param extent Размер тайла в целочисленных единицах
+    TileEncoder(const BBox& box, uint32_t extent)
+        : _box(box), _sx(extent / (box.maxX - box.minX)), _sy(extent / (box.maxY - box.minY)), _cx(0), _cy(0) {}
+
+    /// @brief Принять вершину результата отсечения
+    void emit(const Point& v) {
+        std::pair<int32_t, int32_t> q((int32_t)std::lround((v.x - _box.minX) * _sx),
+                                      (int32_t)std::lround((_box.maxY - v.y) * _sy));
+        if (!_ring.empty() && _ring.back() == q) return;
+        _ring.push_back(q);
+    }
+
+    /// @brief Завершить кольцо и дописать его команды
+    /// @return false если после квантования кольцо выродилось
+    bool closeRing() {
+        while (_ring.size() > 1 && _ring.front() == _ring.back()) _ring.pop_back();
+        long long area = 0;
+        for (size_t i = 0; i < _ring.size(); ++i) {
+            const auto& p = _ring[i];
+            const auto& q = _ring[(i + 1) % _ring.size()];
+            area += (long long)p.first * q.second - (long long)q.first * p.second;
+        }
+        if (_ring.size() < 3 || area == 0) {
+            _ring.clear();
+            return false;
+        }
+        if (area < 0) std::reverse(_ring.begin(), _ring.end());
+        _commands.push_back(command(1, 1));
+        move(_ring[0]);
+        _commands.push_back(command(2, _ring.size() - 1));
+        for (size_t i = 1; i < _ring.size(); ++i) move(_ring[i]);
+        _commands.push_back(command(7, 1));
+        _ring.clear();
+        return true;
+    }
+
+    /// @brief Закодированная геометрия
+    const std::vector<uint32_t>& commands() const { return _commands; }
+
+private:
+    /// @brief Заголовок команды: идентификатор и число повторов
+    static uint32_t command(uint32_t id, uint32_t count) { return (id & 0x7) | (count << 3); }
+
+    /// @brief Зигзаг-кодирование знакового смещения
+    static uint32_t zigzag(int32_t n) { return ((uint32_t)n << 1) ^ (uint32_t)(n >> 31); }
+
+    /// @brief Записать смещение курсора до точки
+    void move(const std::pair<int32_t, int32_t>& q) {
+        _commands.push_back(zigzag(q.first - _cx));
+        _commands.push_back(zigzag(q.second - _cy));
+        _cx = q.first;
+        _cy = q.second;
+    }
+
+    BBox _box;                                     ///< Охват тайла
+    double _sx, _sy;                               ///< Масштаб в единицы тайла
+    int32_t _cx, _cy;                              ///< Курсор кодировщика
+    std::vector<std::pair<int32_t, int32_t>> _ring; ///< Квантованное текущее кольцо
+    std::vector<uint32_t> _commands;               ///< Команды геометрии
+};
+
+/// @class CoverageRaster
+/// @brief Точная доля площади многоугольника в каждом пикселе сетки
+///
+/// Каждое ребро добавляет в буфер накопления ориентированную площадь своей трапеции
+/// в пикселях строки; после префиксной суммы по буферу значение в пикселе равно доле
+/// его площади, покрытой многоугольником.
+class CoverageRaster {
+public:
+    /// @brief Конструктор
+    /// @param box Охват сетки
+    /// @param width Число столбцов
+    /// @param height Число строк (строка 0 — верхняя, у box.maxY)
+    CoverageRaster(const BBox& box, size_t width, size_t height)
+        : _box(box), _width(width), _height(height), _acc(width * height + 4, 0.0) {}
+
+    /// @brief Добавить кольцо (любая ориентация; вершины внутри охвата)
+    void addRing(const std::vector<Point>& ring) {
+        for (size_t i = 0; i < ring.size(); ++i) line(toPixels(ring[i]), toPixels(ring[(i + 1) % ring.size()]));
+    }
+
+    /// @brief Покрытие пикселей 0..255 построчно сверху вниз
+    std::vector<uint8_t> coverage() const {
+        std::vector<uint8_t> result(_width * _height);
+        double sum = 0;
+        for (size_t i = 0; i < result.size(); ++i) {
+            sum += _acc[i];
+            result[i] = (uint8_t)std::lround(std::min(1.0, std::abs(sum)) * 255);
+        }
+        return result;
+    }
+
+private:
+    /// @brief Координаты в пикселях сетки
+    Point toPixels(const Point& v) const {
+        double x = (v.x - _box.minX) / (_box.maxX - _box.minX) * _width;
+        double y = (_box.maxY - v.y) / (_box.maxY - _box.minY) * _height;
+        return Point(std::min(std::max(x, 0.0), (double)_width), std::min(std::max(y, 0.0), (double)_height));
+    }
+
+    /// @brief Накопить площадь под отрезком построчно
+    void line(Point p0, Point p1) {
+        if (p0.y == p1.y) return;
+        double dir = 1;
+        if (p0.y > p1.y) {
+            std::swap(p0, p1);
+            dir = -1;
+        }
+        double dxdy = (p1.x - p0.x) / (p1.y - p0.y);
+        double x = p0.x;
+        size_t yEnd = std::min(_height, (size_t)std::ceil(p1.y));
+        for (size_t y = (size_t)p0.y; y < yEnd; ++y) {
+            double* row = &_acc[y * _width];
+            double dy = std::min(y + 1.0, p1.y) - std::max((double)y, p0.y);
+            double xNext = x + dxdy * dy;
+            double d = dy * dir;
+            double x0 = std::min(x, xNext), x1 = std::max(x, xNext);
+            double x0Floor = std::floor(x0), x1Ceil = std::ceil(x1);
+            size_t x0i = (size_t)x0Floor, x1i = (size_t)x1Ceil;
+            if (x1i <= x0i + 1) {
+                double xmf = 0.5 * (x + xNext) - x0Floor;
+                row[x0i] += d - d * xmf;
+                row[x0i + 1] += d * xmf;
+            } else {
+                double s = 1 / (x1 - x0);
+                double x0f = x0 - x0Floor;
+                double a0 = 0.5 * s * (1 - x0f) * (1 - x0f);
+                double x1f = x1 - x1Ceil + 1;
+                double am = 0.5 * s * x1f * x1f;
+                row[x0i] += d * a0;
+                if (x1i == x0i + 2) {
+                    row[x0i + 1] += d * (1 - a0 - am);
+                } else {
+                    double a1 = s * (1.5 - x0f);
+                    row[x0i + 1] += d * (a1 - a0);
+                    for (size_t xi = x0i + 2; xi + 1 < x1i; ++xi) row[xi] += d * s;
+                    double a2 = a1 + (x1i - x0i - 3) * s;
+                    row[x1i - 1] += d * (1 - a2 - am);
+                }
+                row[x1i] += d * am;
+            }
+            x = xNext;
+        }
+    }
+
+    BBox _box;                ///< Охват сетки
+    size_t _width, _height;   ///< Размер сетки
+    std::vector<double> _acc; ///< Буфер накопления с запасом на правый край
+};
+
+/// @struct PolygonStore
+/// @brief Многоугольники с дырами в непрерывных массивах
+///
+/// Вершины всех колец лежат подряд; ringEnd[i] — конец i-го кольца в points,
+/// polygonEnd[j] — конец j-го многоугольника в кольцах (первое кольцо внешнее).
+struct PolygonStore {
+    std::vector<Point> points;        ///< Вершины всех колец
+    std::vector<uint32_t> ringEnd;    ///< Концы колец
+    std::vector<uint32_t> polygonEnd; ///< Концы многоугольников
+
+    /// @brief Число многоугольников
+    size_t size() const { return polygonEnd.size(); }
+
+    /// @brief Первое кольцо многоугольника
+    size_t firstRing(size_t polygon) const { return polygon ? polygonEnd[polygon - 1] : 0; }
+
+    /// @brief Вершины кольца
+    std::vector<Point> ring(size_t r) const {
+        return std::vector<Point>(points.begin() + (r ? ringEnd[r - 1] : 0), points.begin() + ringEnd[r]);
+    }
+};
+
+/// @class GeoJsonScanner
+/// @brief Потоковый разбор многоугольников GeoJSON прямо в PolygonStore
+///
+/// Документ не строится: ключи "coordinates" находятся поиском по байтам (memmem и memchr
+/// из libc векторизованы), числа читаются std::from_chars без выделения памяти. Глубина
+/// вложенности массивов отличает Polygon от MultiPolygon; прочие геометрии пропускаются.
+/// Каждый многоугольник (в том числе каждая часть MultiPolygon) — отдельный элемент.
+class GeoJsonScanner {
+public:
+    /// @brief Конструктор
+    /// @param data Текст GeoJSON: Feature, FeatureCollection или геометрия
+    /// @param size Длина текста
+    GeoJsonScanner(const char* data, size_t size) : _p(data), _end(data + size) {}
+
+    /// @brief Разобрать все многоугольники документа
+    /// @throws std::runtime_error при некорректных координатах
+    void scan(PolygonStore& store) {
+        static const char KEY[] = "\"coordinates\"";
+        const size_t keyLength = sizeof(KEY) - 1;
+        store.points.reserve((_end - _p) / 24);
+        while (_p < _end) {
+            const char* key = (const char*)memmem(_p, _end - _p, KEY, keyLength);
+            if (!key) break;
+            _p = key + keyLength;
+            skipSpace();
+            if (_p == _end || *_p != ':') continue; // строковое значение, а не ключ
+            ++_p;
+            skipSpace();
+            int depth = 0;
+            for (const char* q = _p; q < _end && (*q == '[' || isSpace(*q)); ++q) depth += *q == '[';
+            if (depth == 3) {
+                polygon(store);
+            } else if (depth == 4) {
+                expect('[');
+                if (!tryClose()) {
+                    do polygon(store); while (separator());
+                }
+            }
+        }
+    }
+
+private:
+    /// @brief Пробельный символ JSON
+    static bool isSpace(char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t'; }
+
+    /// @brief Пропустить пробелы
+    void skipSpace() { while (_p < _end && isSpace(*_p)) ++_p; }
+
+    /// @brief Ожидать символ
+    void expect(char c) {
+        skipSpace();
+        if (_p == _end || *_p != c) throw std::runtime_error("Bad GeoJSON coordinates");
+        ++_p;
+    }
+
+    /// @brief Закрыть массив, если он пуст или кончился
+    bool tryClose() {
+        skipSpace();
+        if (_p < _end && *_p == ']') {
+            ++_p;
+            return true;
+        }
+        return false;
+    }
+
+    /// @brief Запятая — следующий элемент; "]" — конец массива
+    bool separator() {
+        skipSpace();
+        if (_p < _end && *_p == ',') {
+            ++_p;
+            return true;
+        }
+        expect(']');
+        return false;
+    }
+
+    /// @brief Прочитать число
+    double number() {
+        skipSpace();
+        double v;
+        auto r = std::from_chars(_p, _end, v);
+        if (r.ec != std::errc()) throw std::runtime_error("Bad GeoJSON number");
+        _p = r.ptr;
+        return v;
+    }
+
+    /// @brief Прочитать позицию [x, y, ...]; лишние измерения отбрасываются
+    Point position() {
+        expect('[');
+        double x = number();
+        expect(',');
+        double y = number();
+        while (separator()) number();
+        return Point(x, y);
+    }
+
+    /// @brief Прочитать многоугольник [[[x, y], ...], ...]
+    void polygon(PolygonStore& store) {
+        expect('[');
+        if (!tryClose()) {
+            do {
+                size_t begin = store.points.size();
+                expect('[');
+                if (!tryClose()) {
+                    do store.points.push_back(position()); while (separator());
+                }
+                // Кольцо GeoJSON замкнуто повтором первой вершины
+                if (store.points.size() - begin > 1 && store.points.back().x == store.points[begin].x &&
+                    store.points.back().y == store.points[begin].y) store.points.pop_back();
+                store.ringEnd.push_back(store.points.size());
+            } while (separator());
+        }
+        store.polygonEnd.push_back(store.ringEnd.size());
+    }
+
+    const char* _p;   ///< Текущая позиция
+    const char* _end; ///< Конец текста
+};
+
+/// @brief Отсечь многоугольник хранилища выпуклым планом: внешнее кольцо и дыры по отдельности
+/// @return Кольца результата (пусто, если внешнее кольцо не пересекает окно)
+Rings clipStored(const PolygonStore& store, size_t polygon, const ClipPlan& plan) {
+    Rings rings;
+    for (size_t r = store.firstRing(polygon); r < store.polygonEnd[polygon]; ++r) {
+        std::vector<Point> clipped;
+        if (clipConvex(store.ring(r), plan, clipped)) rings.push_back(std::move(clipped));
+        else if (r == store.firstRing(polygon)) break;
+    }
+    return rings;
+}
+
+/// @struct Layer
+/// @brief Загруженный на сервер слой многоугольников с пространственным индексом
+///
+/// Вершины лежат в PolygonStore, для каждого многоугольника заранее посчитан охват
+/// внешнего кольца; R-дерево по охватам отбирает многоугольники, задевающие окно.
+struct Layer {
+    PolygonStore features;   ///< Многоугольники слоя
+    std::vector<BBox> boxes; ///< Охваты многоугольников
+    RTree index;             ///< Индекс по охватам
+
+    /// @brief Построить слой из разобранных многоугольников
+    explicit Layer(PolygonStore store) : features(std::move(store)) {
+        boxes.reserve(features.size());
+        for (size_t i = 0; i < features.size(); ++i) {
+            size_t r = features.firstRing(i);
+            size_t begin = r ? features.ringEnd[r - 1] : 0;
+            boxes.push_back(boundingBox(features.points.data() + begin, features.ringEnd[r] - begin));
+        }
+        index = RTree(boxes);
+    }
+
+    /// @brief Вершин в многоугольнике
+    size_t vertices(size_t polygon) const {
+        size_t r = features.firstRing(polygon);
+        return features.ringEnd[features.polygonEnd[polygon] - 1] - (r ? features.ringEnd[r - 1] : 0);
+    }
+};
+
+/// @class LayerRegistry
+/// @brief Загруженные слои по идентификаторам
+class LayerRegistry {
+public:
+    LayerRegistry() : _next(1) {}
+
+    /// @brief Добавить слой
+    /// @return Идентификатор слоя
+    uint64_t add(std::shared_ptr<const Layer> layer) {
+        LOCK(lock, _mutex);
+        uint64_t id = _next++;
+        _layers[id] = std::move(layer);
+        return id;
+    }
+
+    /// @brief Найти слой
+    /// @return nullptr если слоя нет
+    std::shared_ptr<const Layer> find(uint64_t id) {
+        LOCK(lock, _mutex);
+        auto it = _layers.find(id);
+        return it == _layers.end() ? nullptr : it->second;
+    }
+
+    /// @brief Выгрузить слой (идущие запросы дочитывают свою копию указателя)
+    /// @return false если слоя нет
+    bool remove(uint64_t id) {
+        LOCK(lock, _mutex);
+        return _layers.erase(id) > 0;
+    }
+
+private:
+    uint64_t _next;    ///< Следующий идентификатор
+    std::unordered_map<uint64_t, std::shared_ptr<const Layer>> _layers; ///< Слои
+    std::mutex _mutex; ///< Доступ из потоков транспортов
+};
+
+/// @brief Общий реестр слоёв сервера
+LayerRegistry layerRegistry;
+
+/// @struct RequestRejected
+/// @brief Запрос прочитан целиком, но выполнить его нельзя (неизвестный идентификатор,
+///        некорректный документ): ответ "ERROR", а поток постоянного соединения не сбит
+struct RequestRejected : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+/// @brief Прочитать вершины в формате "n x1 y1 ... xn yn"
+/// @param in Входной поток
+/// @throws std::runtime_error при некорректных данных
+std::vector<Point> readPoints(std::istream& in) {
+    int size;
+    if (!(in >> size) || size < 0) throw std::runtime_error("Bad polygon size");
+    std::vector<Point> points;
+    points.reserve(std::min(size, 1 << 16)); // размер задаёт клиент
+    for (int i = 0; i < size; ++i) {
+        double x, y;
+        if (!(in >> x >> y)) throw std::runtime_error("Bad polygon vertex");
+        points.push_back(Point(x, y));
+    }
+    return points;
+}
+
+/// @brief Прочитать многоугольник в формате "n x1 y1 ... xn yn"
+/// @param in Входной поток
+/// @param poly Многоугольник для заполнения
+/// @throws std::runtime_error при некорректных данных
+void readPolygon(std::istream& in, Polygon& poly) {
+    for (const Point& v : readPoints(in)) poly.insert(v);
+}
+
+/// @brief Записать многоугольник в ответ: число вершин и координаты по строкам
+void writePolygon(std::ostream& out, Polygon& poly) {
+    out << poly.size() << "\n";
+    Vertex* v = poly._v;
+    if (!v) return;
+    do {
+        out << v->x << " " << v->y << "\n";
+        v = v->cw();
+    } while (v != poly._v);
+}
+
+/// @brief Записать набор колец: "OK", число колец, затем каждое кольцо как многоугольник
+/// @note Пустой набор записывается как "FAIL"
+void writeRings(std::ostream& out, const std::vector<std::vector<Point>>& rings) {
+    if (rings.empty()) {
+        out << "FAIL\n";
+        return;
+    }
+    out << "OK\n" << rings.size() << "\n";
+    for (const auto& ring : rings) {
+        out << ring.size() << "\n";
+        for (const Point& v : ring) out << v.x << " " << v.y << "\n";
+    }
+}
+
+/// @brief Запрос отсечения "s_size s... p_size p..."
+///
+/// Задание несёт отсекатель и вычисление с готовым планом, так что планировщик может
+/// объединить одновременные запросы с одним окном в пакет.
+Job parseClip(std::istream& in) {
+    auto s = std::make_shared<Polygon>(), p = std::make_shared<Polygon>();
+    readPolygon(in, *s);
+    readPolygon(in, *p);
+    auto runPlanned = [s](const ClipPlan& plan, std::ostream& out) {
+        Polygon* result = nullptr;
+        if (clipPolygon(*s, plan, result)) {
+            out << "OK\n";
+            writePolygon(out, *result);
+            delete result;
+        } else {
+            out << "FAIL\n";
+        }
+    };
+    Job job(s->size() + p->size(), [p, runPlanned](std::ostream& out) { runPlanned(*currentPlans().get(*p), out); });
+    job.clipper = p;
+    job.batchKey = hashPolygon(*p);
+    job.runPlanned = runPlanned;
+    return job;
+}
+
+/// @brief Записать многоугольник из вершин: "OK", число вершин и вершины, либо "FAIL"
+void writePoints(std::ostream& out, const std::vector<Point>& points) {
+    if (points.empty()) {
+        out << "FAIL\n";
+        return;
+    }
+    out << "OK\n" << points.size() << "\n";
+    for (const Point& v : points) out << v.x << " " << v.y << "\n";
+}
+
+/// @brief Запрос "HALFPLANES m a1 b1 c1 ... s_size s...": отсечь областью a*x + b*y <= c
+Job parseHalfPlanes(std::istream& in) {
+    int m;
+    if (!(in >> m) || m < 0 || m > HALFPLANES_MAX) throw std::runtime_error("Bad constraint count");
+    std::vector<HalfPlane> constraints;
+    constraints.reserve(std::min(m, 1 << 16)); // размер задаёт клиент
+    for (int i = 0; i < m; ++i) {
+        HalfPlane h;
+        if (!(in >> h.a >> h.b >> h.c)) throw std::runtime_error("Bad constraint");
+        constraints.push_back(h);
+    }
+    std::vector<Point> subject = readPoints(in);
+    size_t cost = subject.size() + constraints.size();
+    return Job(cost, [constraints = std::move(constraints), subject = std::move(subject)](std::ostream& out) {
+        std::vector<Point> result;
+        ClipPlan plan(constraints);
+        clipConvex(subject, plan, result);
+        writePoints(out, result);
+    });
+}
+
+/// @brief Запрос "FRUSTUM attrs count" и count многоугольников "n v1 ... vn", вершина — "x y z w a1 ... a_attrs"
+///
+/// Ответ: "OK", число многоугольников и каждый результат в том же формате;
+/// отброшенный многоугольник записывается как 0 вершин.
+Job parseFrustum(std::istream& in) {
+    int attrs, count;
+    if (!(in >> attrs >> count) || attrs < 0 || attrs > FRUSTUM_MAX_ATTRS || count < 0)
+        throw std::runtime_error("Bad batch header");
+    auto batch = std::make_shared<VertexBatch4>();
+    batch->attrs = attrs;
+    std::vector<double> vertex(4 + attrs);
+    for (int p = 0; p < count; ++p) {
+        int n;
+        if (!(in >> n) || n < 0) throw std::runtime_error("Bad polygon size");
+        for (int i = 0; i < n; ++i) {
+            for (double& v : vertex)
+                if (!(in >> v)) throw std::runtime_error("Bad vertex");
+            batch->push(vertex.data());
+        }
+        batch->close();
+    }
+
+    return Job(batch->x.size(), [batch](std::ostream& out) {
+        VertexBatch4 result = clipFrustum(*batch);
+        out << "OK\n" << result.polygons() << "\n";
+        for (size_t p = 0; p < result.polygons(); ++p) {
+            out << result.offsets[p + 1] - result.offsets[p] << "\n";
+            for (size_t i = result.offsets[p]; i < result.offsets[p + 1]; ++i) {
+                out << result.x[i] << " " << result.y[i] << " " << result.z[i] << " " << result.w[i];
+                for (size_t k = 0; k < result.attrs; ++k) out << " " << result.attr[i * result.attrs + k];
+                out << "\n";
+            }
+        }
+    });
+}
+
+/// @brief Запрос "MESH nv x y ... nt i j k ... p_size p...": отсечь индексированную сетку треугольников
+///
+/// Ответ: "OK", число вершин и вершины, число треугольников и тройки индексов; "FAIL" если пусто.
+Job parseMesh(std::istream& in) {
+    auto mesh = std::make_shared<Mesh>();
+    mesh->vertices = readPoints(in);
+    int nt;
+    if (!(in >> nt) || nt < 0) throw std::runtime_error("Bad triangle count");
+    for (int t = 0; t < nt; ++t) {
+        std::array<uint32_t, 3> face;
+        for (uint32_t& v : face)
+            if (!(in >> v) || v >= mesh->vertices.size()) throw std::runtime_error("Bad triangle index");
+        mesh->faces.push_back(face);
+    }
+    auto p = std::make_shared<Polygon>();
+    readPolygon(in, *p);
+
+    return Job(mesh->vertices.size() + 3 * mesh->faces.size() + p->size(), [mesh, p](std::ostream& out) {
+        Mesh result = clipMesh(*mesh, *currentPlans().get(*p));
+        if (result.faces.empty()) {
+            out << "FAIL\n";
+            return;
+        }
+        out << "OK\n" << result.vertices.size() << "\n";
+        for (const Point& v : result.vertices) out << v.x << " " << v.y << "\n";
+        out << result.faces.size() << "\n";
+        for (const auto& face : result.faces) out << face[0] << " " << face[1] << " " << face[2] << "\n";
+    });
+}
+
+/// @brief Запрос "UNION k" и k многоугольников "n x y ...": объединить, ответ — набор колец
+Job parseUnion(std::istream& in) {
+    int k;
+    if (!(in >> k) || k < 0) throw std::runtime_error("Bad polygon count");
+    std::vector<std::vector<Point>> polygons;
+    size_t cost = 0;
+    for (int i = 0; i < k; ++i) {
+        polygons.push_back(readPoints(in));
+        cost += polygons.back().size();
+    }
+    return Job(cost, [polygons = std::move(polygons)](std::ostream& out) mutable {
+        writeRings(out, cascadedUnion(std::move(polygons)));
+    });
+}
+
+/// @brief Запрос "MULTICLIP s_size s... k p1_size p1... pk_size pk...": отсечь субъект k окнами
+///
+/// Ответ: "OK", k и результат каждого окна по порядку как число вершин и вершины (0 — пусто).
+Job parseMultiClip(std::istream& in) {
+    std::vector<Point> subject = readPoints(in);
+    int k;
+    if (!(in >> k) || k < 0) throw std::runtime_error("Bad window count");
+    std::vector<std::shared_ptr<Polygon>> windows;
+    size_t cost = subject.size();
+    for (int i = 0; i < k; ++i) {
+        windows.push_back(std::make_shared<Polygon>());
+        readPolygon(in, *windows.back());
+        cost += windows.back()->size();
+    }
+    return Job(cost, [subject = std::move(subject), windows = std::move(windows)](std::ostream& out) {
+        std::vector<std::shared_ptr<const ClipPlan>> plans;
+        for (const auto& p : windows) plans.push_back(currentPlans().get(*p));
+        std::vector<std::vector<Point>> results = clipMany(subject, plans);
+        out << "OK\n" << results.size() << "\n";
+        for (const auto& ring : results) {
+            out << ring.size() << "\n";
+            for (const Point& v : ring) out << v.x << " " << v.y << "\n";
+        }
+    });
+}
+
+/// @brief Запрос "PYRAMID min_zoom max_zoom x0 y0 x1 y1 s_size s...": пирамида тайлов субъекта
+///
+/// Ответ: "OK", число тайлов и для каждого строка "z x y" и многоугольник; "FAIL" если пусто.
+Job parsePyramid(std::istream& in) {
+    int minZoom, maxZoom;
+    double x0, y0, x1, y1;
+    if (!(in >> minZoom >> maxZoom >> x0 >> y0 >> x1 >> y1)) throw std::runtime_error("Bad pyramid header");
+    if (minZoom < 0 || maxZoom < minZoom || maxZoom > PYRAMID_MAX_ZOOM || !(x0 < x1 && y0 < y1))
+        throw std::runtime_error("Bad pyramid range");
+    std::vector<Point> subject = readPoints(in);
+    BBox bounds;
+    bounds.add(Point(x0, y0));
+    bounds.add(Point(x1, y1));
+
+    size_t cost = subject.size() * (maxZoom - minZoom + 1);
+    return Job(cost, [subject = std::move(subject), bounds, minZoom, maxZoom](std::ostream& out) {
+        std::vector<Tile> tiles = buildPyramid(subject, bounds, minZoom, maxZoom);
+        if (tiles.empty()) {
+            out << "FAIL\n";
+            return;
+        }
+        out << "OK\n" << tiles.size() << "\n";
+        for (const Tile& tile : tiles) {
+            out << tile.z << " " << tile.x << " " << tile.y << "\n" << tile.geometry.size() << "\n";
+            for (const RankedPoint& v : tile.geometry) out << v.p.x << " " << v.p.y << "\n";
+        }
+    });
+}
+
+/// @brief Запрос "CLIPMVT extent s_size s... p_size p...": отсечь и выдать геометрию векторного тайла
+///
+/// Тайл — ограничивающий прямоугольник отсекателя, разбитый на extent единиц по каждой оси.
+/// Ответ: "OK", число команд и команды через пробел; "FAIL" если результат пуст.
+Job parseClipTile(std::istream& in) {
+    uint32_t extent;
+    if (!(in >> extent) || extent == 0 || extent > TILE_MAX_EXTENT) throw std::runtime_error("Bad extent");
+    std::vector<Point> subject = readPoints(in);
+    auto p = std::make_shared<Polygon>();
+    readPolygon(in, *p);
+
+    size_t cost = subject.size() + p->size();
+    return Job(cost, [extent, subject = std::move(subject), p](std::ostream& out) {
+        std::shared_ptr<const ClipPlan> plan = currentPlans().get(*p);
+        BBox box = boundingBox(plan->vertices.data(), plan->vertices.size());
+        TileEncoder encoder(box, extent);
+        if (!clipConvexInto(subject, *plan, encoder) || !encoder.closeRing()) {
+            out << "FAIL\n";
+            return;
+        }
+        const std::vector<uint32_t>& commands = encoder.commands();
+        out << "OK\n" << commands.size() << "\n";
+        for (size_t i = 0; i < commands.size(); ++i) out << (i ? " " : "") << commands[i];
+        out << "\n";
+    });
+}
+
+/// @brief Запрос "COVERAGE w h x0 y0 x1 y1 s_size s... p_size p...": маска покрытия результата отсечения
+///
+/// Ответ: "OK", строка "w h runs" и пары "значение длина" (покрытие 0..255, строки сверху вниз).
+Job parseCoverage(std::istream& in) {
+    size_t width, height;
+    double x0, y0, x1, y1;
+    if (!(in >> width >> height >> x0 >> y0 >> x1 >> y1)) throw std::runtime_error("Bad grid");
+    // Каждая сторона ограничена отдельно: произведение size_t от клиента может переполниться
+    if (width == 0 || height == 0 || width > COVERAGE_MAX_PIXELS || height > COVERAGE_MAX_PIXELS / width ||
+        !(x0 < x1 && y0 < y1))
+        throw std::runtime_error("Bad grid size");
+    std::vector<Point> subject = readPoints(in);
+    auto p = std::make_shared<Polygon>();
+    readPolygon(in, *p);
+
+    size_t cost = subject.size() + p->size() + width * height;
+    return Job(cost, [=, subject = std::move(subject)](std::ostream& out) {
+        std::vector<Point> clipped, inGrid;
+        FixedClipPlan<4> grid({Point(x0, y0), Point(x1, y0), Point(x1, y1), Point(x0, y1)});
+        CoverageRaster raster(grid.box, width, height);
+        if (clipConvex(subject, *currentPlans().get(*p), clipped) && clipConvex(clipped, grid, inGrid))
+            raster.addRing(inGrid);
+
+        std::vector<std::pair<int, size_t>> runs;
+        for (uint8_t v : raster.coverage()) {
+            if (!runs.empty() && runs.back().first == v) runs.back().second++;
+            else runs.push_back({v, 1});
+        }
+        out << "OK\n" << width << " " << height << " " << runs.size() << "\n";
+        for (size_t i = 0; i < runs.size(); ++i) out << (i ? " " : "") << runs[i].first << " " << runs[i].second;
+        out << "\n";
+    });
+}
+
+/// @brief Прочитать "nbytes", перевод строки и nbytes байт GeoJSON и разобрать многоугольники
+/// @throws std::runtime_error если текст не дочитан; RequestRejected если он прочитан,
+///         но координаты некорректны
+std::shared_ptr<PolygonStore> readGeoJson(std::istream& in) {
+    size_t size;
+    if (!(in >> size) || size > GEOJSON_MAX_BYTES) throw std::runtime_error("Bad GeoJSON size");
+    in.get();
+    std::vector<char> text;
+    text.reserve(std::min<size_t>(size, 1 << 20)); // размер задаёт клиент: память растёт по мере чтения
+    char chunk[1 << 16];
+    while (text.size() < size) {
+        size_t n = std::min(sizeof(chunk), size - text.size());
+        if (!in.read(chunk, n)) throw std::runtime_error("Truncated GeoJSON");
+        text.insert(text.end(), chunk, chunk + n);
+    }
+
+    auto store = std::make_shared<PolygonStore>();
+    try {
+        GeoJsonScanner(text.data(), text.size()).scan(*store);
+    } catch (const std::runtime_error& e) {
+        throw RequestRejected(e.what());
+    }
+    return store;
+}
+
+/// @brief Запрос "GEOJSON p_size p... nbytes", перевод строки и nbytes байт GeoJSON
+///
+/// Каждый многоугольник документа отсекается окном (внешнее кольцо и дыры по отдельности,
+/// что верно для выпуклого окна), большие коллекции — параллельно. Ответ: "OK", число
+/// многоугольников и для каждого число колец результата и кольца (0 — пересечения нет).
+Job parseGeoJson(std::istream& in) {
+    auto p = std::make_shared<Polygon>();
+    readPolygon(in, *p);
+    std::shared_ptr<PolygonStore> store = readGeoJson(in);
+    return Job(store->points.size() + p->size(), [store, p](std::ostream& out) {
+        std::shared_ptr<const ClipPlan> plan = currentPlans().get(*p);
+        std::vector<Rings> results(store->size());
+        auto clipFeature = [&](size_t i) { results[i] = clipStored(*store, i, *plan); };
+        if (store->points.size() >= PARALLEL_MIN_WORK) workerPool.parallelFor(store->size(), clipFeature);
+        else for (size_t i = 0; i < store->size(); ++i) clipFeature(i);
+
+        out << "OK\n" << results.size() << "\n";
+        for (const Rings& rings : results) {
+            out << rings.size() << "\n";
+            for (const auto& ring : rings) {
+                out << ring.size() << "\n";
+                for (const Point& v : ring) out << v.x << " " << v.y << "\n";
+            }
+        }
+    });
+}
+
+/// @brief Запрос "LAYER nbytes", перевод строки и nbytes байт GeoJSON: загрузить слой
+///
+/// Многоугольники разбираются так же, как в GEOJSON, и индексируются R-деревом.
+/// Ответ: "OK", идентификатор слоя и число многоугольников.
+Job parseLayer(std::istream& in) {
+    std::shared_ptr<PolygonStore> store = readGeoJson(in);
+    return Job(store->points.size(), [store](std::ostream& out) {
+        auto layer = std::make_shared<const Layer>(std::move(*store));
+        size_t count = layer->features.size();
+        out << "OK\n" << layerRegistry.add(std::move(layer)) << " " << count << "\n";
+    });
+}
+
+/// @brief Запрос "UNLOAD id": выгрузить слой, ответ "OK" или "FAIL"
+Job parseUnload(std::istream& in) {
+    uint64_t id;
+    if (!(in >> id)) throw std::runtime_error("Bad layer id");
+    return Job(0, [id](std::ostream& out) { out << (layerRegistry.remove(id) ? "OK\n" : "FAIL\n"); });
+}
+
+/// @brief Запрос "VIEWPORT id p_size p...": многоугольники слоя в выпуклом окне
+///
+/// Кандидаты отбираются R-деревом по охвату окна ещё при разборе (их вершины — оценка
+/// стоимости). Многоугольник, охват которого целиком внутри окна, отдаётся без отсечения,
+/// остальные отсекаются как в GEOJSON. Ответ: "OK", число задетых многоугольников и для
+/// каждого по возрастанию номера строка "номер число_колец", затем кольца.
+Job parseViewport(std::istream& in) {
+    uint64_t id;
+    if (!(in >> id)) throw std::runtime_error("Bad layer id");
+    std::vector<Point> window = readPoints(in);
+    std::shared_ptr<const Layer> layer = layerRegistry.find(id);
+    if (!layer) throw RequestRejected("Unknown layer");
+
+    auto hits = std::make_shared<std::vector<uint32_t>>();
+    layer->index.query(boundingBox(window.data(), window.size()), [&](uint32_t i) { hits->push_back(i); });
+    std::sort(hits->begin(), hits->end());
+    size_t cost = window.size();
+    for (uint32_t i : *hits) cost += layer->vertices(i);
+
+    auto p = std::make_shared<Polygon>();
+    for (const Point& v : window) p->insert(v);
+    return Job(cost, [layer, hits, p, cost](std::ostream& out) {
+        std::shared_ptr<const ClipPlan> plan = currentPlans().get(*p);
+        auto inside = [&](double x, double y) {
+            for (size_t k = 0; k < plan->size(); ++k)
+                if (plan->a[k] * x + plan->b[k] * y + plan->c[k] > 0) return false;
+            return true;
+        };
+        std::vector<Rings> results(hits->size());
+        auto clipFeature = [&](size_t i) {
+            uint32_t f = (*hits)[i];
+            const BBox& box = layer->boxes[f];
+            if (inside(box.minX, box.minY) && inside(box.maxX, box.minY) && inside(box.maxX, box.maxY) &&
+                inside(box.minX, box.maxY)) {
+                const PolygonStore& features = layer->features;
+                for (size_t r = features.firstRing(f); r < features.polygonEnd[f]; ++r)
+                    results[i].push_back(features.ring(r));
+            } else {
+                results[i] = clipStored(layer->features, f, *plan);
+            }
+        };
+        if (plan->valid()) {
+            if (cost >= PARALLEL_MIN_WORK) workerPool.parallelFor(hits->size(), clipFeature);
+            else for (size_t i = 0; i < hits->size(); ++i) clipFeature(i);
+        }
+
+        size_t count = std::count_if(results.begin(), results.end(), [](const Rings& r) { return !r.empty(); });
+        out << "OK\n" << count << "\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (results[i].empty()) continue;
+            out << (*hits)[i] << " " << results[i].size() << "\n";
+            for (const auto& ring : results[i]) {
+                out << ring.size() << "\n";
+                for (const Point& v : ring) out << v.x << " " << v.y << "\n";
+            }
+        }
+    });
+}
+
+/// @brief Запрос "REGISTER p_size p...": зарегистрировать окно, ответ "OK" и идентификатор
+Job parseRegister(std::istream& in) {
+    std::vector<Point> window = readPoints(in);
+    size_t cost = window.size();
+    return Job(cost, [window = std::move(window)](std::ostream& out) {
+        uint64_t id = windowRegistry.add(prepareWindow(window));
+        out << "OK\n" << id << "\n";
+    });
+}
+
+/// @brief Запрос "CLIPW id s_size s...": отсечь зарегистрированным окном, ответ — набор колец
+Job parseClipRegistered(std::istream& in) {
+    uint64_t id;
+    if (!(in >> id)) throw std::runtime_error("Bad window id");
+    std::vector<Point> subject = readPoints(in);
+    std::shared_ptr<const RegisteredWindow> window = windowRegistry.find(id);
+    if (!window) throw RequestRejected("Unknown window");
+    size_t cost = subject.size() * window->pieces.size();
+    return Job(cost, [subject = std::move(subject), window](std::ostream& out) {
+        writeRings(out, clipToWindow(subject, *window));
+    });
+}
+
+/// @brief Запрос "MATCH [PIECES] s_size s...": зарегистрированные окна, которые задевает субъект
+///
+/// Кандидаты отбираются индексом окон по охвату ещё при разборе, затем каждый проверяется
+/// точно по выпуклым частям. Ответ: "OK", число окон и их идентификаторы по возрастанию;
+/// с PIECES — для каждого строка "id число_колец" и кольца отсечения окном.
+Job parseMatch(std::istream& in) {
+    bool pieces = false;
+    in >> std::ws;
+    if (std::isalpha(in.peek())) {
+        std::string flag;
+        in >> flag;
+        if (flag != "PIECES") throw std::runtime_error("Unknown flag " + flag);
+        pieces = true;
+    }
+    std::vector<Point> subject = readPoints(in);
+    auto candidates = std::make_shared<std::vector<WindowRegistry::Entry>>(
+        windowRegistry.candidates(boundingBox(subject.data(), subject.size())));
+    size_t cost = subject.size();
+    for (const auto& c : *candidates) cost += subject.size() * c.second->pieces.size();
+    return Job(cost, [pieces, subject = std::move(subject), candidates](std::ostream& out) {
+        size_t n = candidates->size();
+        std::vector<Rings> results(n);
+        std::vector<char> hit(n, 0);
+        auto test = [&](size_t i) {
+            const RegisteredWindow& window = *(*candidates)[i].second;
+            if (pieces) {
+                results[i] = clipToWindow(subject, window);
+                hit[i] = !results[i].empty();
+            } else {
+                hit[i] = std::any_of(window.pieces.begin(), window.pieces.end(),
+                                     [&](const auto& piece) { return intersectsConvex(subject, *piece); });
+            }
+        };
+        if (n > 1 && subject.size() * n >= PARALLEL_MIN_WORK) workerPool.parallelFor(n, test);
+        else for (size_t i = 0; i < n; ++i) test(i);
+
+        out << "OK\n" << std::count(hit.begin(), hit.end(), 1) << "\n";
+        for (size_t i = 0; i < n; ++i) {
+            if (!hit[i]) continue;
+            out << (*candidates)[i].first;
+            if (pieces) {
+                out << " " << results[i].size() << "\n";
+                for (const auto& ring : results[i]) {
+                    out << ring.size() << "\n";
+                    for (const Point& v : ring) out << v.x << " " << v.y << "\n";
+                }
+            } else {
+                out << "\n";
+            }
+        }
+    });
+}
+
+/// @brief Запрос "POINTS [HILBERT] n id x y ...": в каких зарегистрированных окнах лежит каждая точка
+///
+/// Пакет хранится столбцами; ячейки сетки окон считаются для всех точек одним проходом,
+/// затем каждая точка проверяет окна своей ячейки по охвату и по выпуклым частям за
+/// O(log n). Окна, зарегистрированные после снимка индекса, заранее отбираются по охвату
+/// пакета. Большие пакеты делятся на части по POINTS_CHUNK и идут параллельно.
+/// С HILBERT точки обрабатываются в порядке кривой Гильберта: соседние точки подряд
+/// читают одни и те же ячейки и окна, пока те в кеше; ответ всё равно в исходном порядке.
+/// Ответ: "OK", n и для каждой точки по порядку строка "id k zone1 ... zonek"
+/// (зоны по возрастанию, точка на границе считается внутри).
+Job parsePoints(std::istream& in) {
+    bool hilbert = false;
+    in >> std::ws;
+    if (std::isalpha(in.peek())) {
+        std::string flag;
+        in >> flag;
+        if (flag != "HILBERT") throw std::runtime_error("Unknown flag " + flag);
+        hilbert = true;
+    }
+    size_t n;
+    if (!(in >> n) || n > POINTS_MAX_BATCH) throw std::runtime_error("Bad batch size");
+    auto ids = std::make_shared<std::vector<uint64_t>>();
+    auto xs = std::make_shared<std::vector<double>>(), ys = std::make_shared<std::vector<double>>();
+    size_t reserved = std::min<size_t>(n, 1 << 16); // размер задаёт клиент
+    ids->reserve(reserved);
+    xs->reserve(reserved);
+    ys->reserve(reserved);
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t id;
+        double x, y;
+        if (!(in >> id >> x >> y)) throw std::runtime_error("Bad point");
+        ids->push_back(id);
+        xs->push_back(x);
+        ys->push_back(y);
+    }
+
+    return Job(n, [hilbert, ids, xs, ys](std::ostream& out) {
+        typedef WindowRegistry::Entry Entry;
+        std::vector<Entry> pending;
+        std::shared_ptr<const WindowRegistry::Snapshot> index = windowRegistry.snapshot(pending);
+        size_t n = ids->size();
+        const double* x = xs->data();
+        const double* y = ys->data();
+
+        std::vector<uint32_t> rank;
+        std::vector<double> sortedX, sortedY;
+        if (hilbert) {
+            std::vector<Point> points(n);
+            for (size_t i = 0; i < n; ++i) points[i] = Point(x[i], y[i]);
+            std::vector<uint32_t> order = hilbertOrder(points);
+            rank.resize(n);
+            sortedX.resize(n);
+            sortedY.resize(n);
+            for (size_t k = 0; k < n; ++k) {
+                rank[order[k]] = k;
+                sortedX[k] = x[order[k]];
+                sortedY[k] = y[order[k]];
+            }
+            x = sortedX.data();
+            y = sortedY.data();
+        }
+
+        BBox bounds;
+        std::vector<size_t> cells(n);
+        for (size_t i = 0; i < n; ++i) {
+            cells[i] = index->grid.cell(x[i], y[i]);
+            bounds.add(Point(x[i], y[i]));
+        }
+        pending.erase(std::remove_if(pending.begin(), pending.end(),
+                                     [&](const Entry& e) { return !e.second->box.intersects(bounds); }),
+                      pending.end());
+
+        size_t chunks = (n + POINTS_CHUNK - 1) / POINTS_CHUNK;
+        std::vector<std::vector<uint64_t>> zones(chunks);
+        std::vector<uint32_t> counts(n, 0);
+        auto locate = [&](size_t c) {
+            for (size_t i = c * POINTS_CHUNK; i < std::min(n, (c + 1) * POINTS_CHUNK); ++i) {
+                auto test = [&](const Entry& e) {
+                    const BBox& b = e.second->box;
+                    if (x[i] < b.minX || x[i] > b.maxX || y[i] < b.minY || y[i] > b.maxY) return;
+                    for (const ConvexLocator& piece : e.second->locators)
+                        if (piece.contains(x[i], y[i])) {
+                            zones[c].push_back(e.first);
+                            ++counts[i];
+                            return;
+                        }
+                };
+                for (const uint32_t* z = index->grid.begin(cells[i]); z != index->grid.end(cells[i]); ++z)
+                    test(index->windows[*z]);
+                if (index->grid.hasLarge()) {
+                    size_t first = zones[c].size() - counts[i];
+                    index->grid.visitLarge(x[i], y[i], [&](uint32_t z) { test(index->windows[z]); });
+                    std::sort(zones[c].begin() + first, zones[c].end());
+                }
+                for (const Entry& e : pending) test(e);
+            }
+        };
+        if (chunks > 1) workerPool.parallelFor(chunks, locate);
+        else if (chunks == 1) locate(0);
+
+        std::vector<const uint64_t*> first(n);
+        for (size_t c = 0, k = 0; c < chunks; ++c) {
+            const uint64_t* z = zones[c].data();
+            for (; k < std::min(n, (c + 1) * POINTS_CHUNK); z += counts[k++]) first[k] = z;
+        }
+        out << "OK\n" << n << "\n";
+        for (size_t i = 0; i < n; ++i) {
+            size_t k = hilbert ? rank[i] : i;
+            out << (*ids)[i] << " " << counts[k];
+            for (uint32_t j = 0; j < counts[k]; ++j) out << " " << first[k][j];
+            out << "\n";
+        }
+    });
+}
+
+/// @brief Запрос "LOAD": текущая загрузка сервера для балансировки по наименее загруженному
+///
+/// Ответ: "OK" и строка "queued running cost latency_ms" — заданий в очереди, выполняемых,
+/// суммарная оценка их стоимости и скользящее среднее времени от приёма до ответа.
+/// Отвечается сразу, минуя очередь, поэтому не ждёт занятых потоков.
+std::string loadReport() {
+    Scheduler::Load load = scheduler.load();
+    std::ostringstream out;
+    out << "OK\n" << load.queued << " " << load.running << " " << load.cost << " " << load.latencyMs << "\n";
+    return out.str();
+}
+
+/// @brief Запрос "METRICS": "OK", число показателей и строки "имя значение"
+std::string metricsReport() {
+    std::ostringstream out;
+    out << "OK\n";
+    metrics.write(out);
+    return out.str();
+}
+
+/// @brief Команды протокола и функции разбора их аргументов
+const std::pair<const char*, Job (*)(std::istream&)> COMMANDS[] = {
+    {"REGISTER", parseRegister},   {"CLIPW", parseClipRegistered}, {"HALFPLANES", parseHalfPlanes},
+    {"FRUSTUM", parseFrustum},     {"MESH", parseMesh},            {"UNION", parseUnion},
+    {"MULTICLIP", parseMultiClip}, {"PYRAMID", parsePyramid},      {"CLIPMVT", parseClipTile},
+    {"COVERAGE", parseCoverage},   {"GEOJSON", parseGeoJson},      {"LAYER", parseLayer},
+    {"UNLOAD", parseUnload},       {"VIEWPORT", parseViewport},    {"MATCH", parseMatch},
+    {"POINTS", parsePoints},
+};
+
+/// @brief Обработать один запрос из потока
+/// @param in Поток с запросом: необязательный префикс "TENANT имя", затем команда
+///           с аргументами либо "s_size s... p_size p..."
+/// @param connection Соединение, по которому пришёл запрос, или nullptr
+/// @param[out] desync true, если разбор оборвался посреди запроса и поток больше не выровнен
+///                    по границе запросов
+/// @return Текст ответа: "OK" с результатом, "FAIL" или "ERROR"
+///
+/// Запрос разбирается в вызывающем потоке, а вычисление ставится в очередь планировщика.
+std::string processRequest(std::istream& in, Connection* connection = nullptr, bool* desync = nullptr) {
+    Job job;
+    if (desync) *desync = false;
+    try {
+        in >> std::ws;
+        if (connection && connection->source) connection->source->beginCapture(WATCHDOG_CAPTURE_BYTES);
+        std::string command, tenantName;
+        if (std::isalpha(in.peek())) in >> command;
+        if (command == "TENANT") {
+            if (!(in >> tenantName)) throw std::runtime_error("Bad tenant");
+            command.clear();
+            in >> std::ws;
+            if (std::isalpha(in.peek())) in >> command;
+        }
+        if (command == "LOAD") return loadReport();
+        if (command == "METRICS") return metricsReport();
+        if (command.empty()) {
+            job = parseClip(in);
+        } else {
+            auto it = std::find_if(std::begin(COMMANDS), std::end(COMMANDS),
+                                   [&](const auto& c) { return command == c.first; });
+            if (it == std::end(COMMANDS)) throw std::runtime_error("Unknown command " + command);
+            job = it->second(in);
+            job.name = it->first;
+        }
+        if (!tenantName.empty()) {
+            try {
+                job.tenant = &tenants.resolve(tenantName);
+            } catch (const std::runtime_error& e) {
+                throw RequestRejected(e.what());
+            }
+        }
+    } catch (const RequestRejected&) {
+        if (connection && connection->source) connection->source->endCapture();
+        return "ERROR\n";
+    } catch (...) {
+        if (connection && connection->source) connection->source->endCapture();
+        if (desync) *desync = true;
+        return "ERROR\n";
+    }
+    if (connection && connection->source) connection->setInput(connection->source->endCapture());
+    return scheduler.execute(std::move(job), connection);
+}
+
+/// @brief Отправить ответ соединения с учётом состояния и счётчиков
+/// @return false при ошибке сокета
+bool sendResponse(int fd, Connection& connection, const std::string& response) {
+    connection.state = Connection::WRITING;
+    bool sent = sendAll(fd, response);
+    connection.bytesOut += response.size();
+    connection.state = Connection::READING;
+    return sent;
+}
+
+/// @brief Исходный режим: один запрос на соединение, ответ и закрытие
+/// @param client_sock Сокет клиента
+///
+/// Запрос разбирается прямо из сокета по счётчикам вершин, поэтому длинные запросы,
+/// пришедшие несколькими сегментами, не обрезаются. Таймаут чтения защищает от
+/// клиентов, не завершивших последнее число разделителем.
+void serveSingleRequest(int client_sock) {
+    timeval timeout{SINGLE_REQUEST_TIMEOUT_SEC, 0};
+    setsockopt(client_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    std::shared_ptr<Connection> connection = connections.open("tcp");
+    FdStreamBuf buf(client_sock);
+    connection->source = &buf;
+    std::istream in(&buf);
+    std::string response = processRequest(in, connection.get());
+    connection->bytesIn = buf.bytesRead();
+    sendResponse(client_sock, *connection, response);
+    connections.close(*connection);
+    close(client_sock);
+}
+
+/// @brief Постоянное соединение: запросы следуют друг за другом до закрытия клиентом
+/// @param client_sock Сокет клиента
+///
+/// Запрос самоограничен счётчиками вершин, поэтому отдельная разметка кадров не нужна.
+/// После ошибки разбора посреди запроса поток рассинхронизирован, и соединение закрывается;
+/// "ERROR" на прочитанный целиком запрос (неизвестное окно, отмена, сбой вычисления)
+/// соединение не рвёт.
+/// @param transport Название транспорта для администрирования
+void servePersistent(int client_sock, const char* transport) {
+    std::shared_ptr<Connection> connection = connections.open(transport);
+    FdStreamBuf buf(client_sock);
+    connection->source = &buf;
+    std::istream in(&buf);
+    while (in >> std::ws, in.peek() != std::char_traits<char>::eof()) {
+        bool desync;
+        std::string response = processRequest(in, connection.get(), &desync);
+        connection->bytesIn = buf.bytesRead();
+        if (!sendResponse(client_sock, *connection, response) || desync) break;
+    }
+    connections.close(*connection);
+    close(client_sock);
+}
+
+/// @brief Обслуживание UDP: одна датаграмма — один запрос
+/// @param fd Привязанный UDP-сокет
+///
+/// Поток ждёт ответа планировщика, поэтому из одного сокета читают несколько таких
+/// потоков — по одному на поток планировщика, — и датаграммы разных клиентов
+/// обрабатываются параллельно.
+void serveUdp(int fd) {
+    std::shared_ptr<Connection> connection = connections.open("udp");
+    std::vector<char> buffer(UDP_MAX_DATAGRAM);
+    while (true) {
+        sockaddr_storage peer;
+        socklen_t peer_len = sizeof(peer);
+        ssize_t n = recvfrom(fd, buffer.data(), buffer.size(), 0, (sockaddr*)&peer, &peer_len);
+        if (n < 0) continue;
+        connection->bytesIn += n;
+        connection->setInput(std::string(buffer.data(), std::min<size_t>(n, WATCHDOG_CAPTURE_BYTES)));
+        std::istringstream iss(std::string(buffer.data(), n));
+        std::string response = processRequest(iss, connection.get());
+        if (response.size() > UDP_MAX_DATAGRAM) response = "ERROR\n";
+        sendto(fd, response.data(), response.size(), 0, (sockaddr*)&peer, peer_len);
+        connection->bytesOut += response.size();
+        connection->state = Connection::READING;
+    }
+}
+
+/// @brief Обслуживание канала в общей памяти
+/// @param channel Отображённый сегмент
+///
+/// В канале один буфер, так что запросы выполняются строго по одному: клиенты ждут
+/// друг друга на семафоре lock, и параллелизм планировщика этому транспорту не доступен.
+void serveSharedMemory(ShmChannel* channel) {
+    std::shared_ptr<Connection> connection = connections.open("shm");
+    while (true) {
+        if (sem_wait(&channel->request) < 0) continue;
+        uint32_t sequence = channel->sequence;
+        uint32_t length = std::min(channel->length, SHM_CAPACITY);
+        connection->bytesIn += length;
+        connection->setInput(std::string(channel->data, std::min<size_t>(length, WATCHDOG_CAPTURE_BYTES)));
+        std::istringstream iss(std::string(channel->data, length));
+        std::string response = processRequest(iss, connection.get());
+        if (response.size() > SHM_CAPACITY) response = "ERROR\n";
+        std::memcpy(channel->data, response.data(), response.size());
+        channel->length = response.size();
+        channel->answered = sequence;
+        connection->bytesOut += response.size();
+        connection->state = Connection::READING;
+        sem_post(&channel->response);
+    }
+}
+
+/// @brief Административный запрос "CONNECTIONS": "OK", число и строки
+///        "id transport state bytes_in bytes_out age_ms job"
+void adminConnections(std::ostream& out) {
+    static const char* STATES[] = {"reading", "waiting", "writing"};
+    std::vector<std::shared_ptr<Connection>> list = connections.list();
+    int64_t now = steadyNs();
+    out << "OK\n" << list.size() << "\n";
+    for (const auto& c : list)
+        out << c->id << " " << c->transport << " " << STATES[c->state] << " " << c->bytesIn << " "
+            << c->bytesOut << " " << (now - c->accepted) / 1000000 << " " << c->job << "\n";
+}
+
+/// @brief Административный запрос "JOBS": "OK", число и строки "id command vertices elapsed_ms worker"
+///
+/// Каждое задание пакета выводится своей строкой с общими потоком, временем и суммарной
+/// стоимостью пакета.
+void adminJobs(std::ostream& out) {
+    std::vector<Scheduler::JobInfo> jobs = scheduler.jobs();
+    int64_t now = steadyNs();
+    size_t count = 0;
+    for (const auto& job : jobs) count += job.batch.size();
+    out << "OK\n" << count << "\n";
+    for (const auto& job : jobs)
+        for (uint64_t id : job.batch)
+            out << id << " " << job.name << " " << job.cost << " " << (now - job.started) / 1000000 << " "
+                << job.worker << "\n";
+}
+
+/// @brief Административный запрос "QUEUES": "OK" и строка "workers queued running cost latency_ms"
+void adminQueues(std::ostream& out) {
+    Scheduler::Load load = scheduler.load();
+    out << "OK\n" << scheduler.workers() << " " << load.queued << " " << load.running << " " << load.cost << " "
+        << load.latencyMs << "\n";
+}
+
+/// @brief Административный запрос "TENANTS": "OK", число и строки "name weight quota queued running jobs failed"
+void adminTenants(std::ostream& out) {
+    std::vector<Tenant*> list = tenants.list();
+    out << "OK\n" << list.size() << "\n";
+    for (Tenant* t : list) {
+        std::pair<size_t, size_t> load = scheduler.tenantLoad(t);
+        out << t->name << " " << t->weight << " " << t->quota << " " << load.first << " " << load.second << " "
+            << t->jobs << " " << t->failed << "\n";
+    }
+}
+
+/// @brief Административный запрос "LOCKS": "OK", число и строки
+///        "site acquisitions contended wait_p50 wait_p99 wait_max hold_p50 hold_p99 hold_max" (нс)
+/// @note Без -DPOLYGON_LOCK_STATS список пуст
+void adminLocks(std::ostream& out) {
+#ifdef POLYGON_LOCK_STATS
+    std::vector<LockSite*> sites = LockSite::list();
+    out << "OK\n" << sites.size() << "\n";
+    for (const LockSite* site : sites)
+        out << site->where << " " << site->wait.count() << " " << site->contended << " " << site->wait.quantile(0.5)
+            << " " << site->wait.quantile(0.99) << " " << site->wait.max() << " " << site->hold.quantile(0.5) << " "
+            << site->hold.quantile(0.99) << " " << site->hold.max() << "\n";
+#else
+    out << "OK\n0\n";
+#endif
+}
+
+/// @brief Административное соединение: команды по одной, ответ "OK" с данными, "FAIL" или "ERROR"
+/// @param client_sock Сокет клиента
+///
+/// Команды: CONNECTIONS, JOBS, QUEUES, TENANTS, METRICS, LOCKS, "CANCEL id". Списки читаются из атомарных
+/// счётчиков соединений и слотов потоков, поэтому опрос не задерживает вычисления.
+void serveAdmin(int client_sock) {
+    FdStreamBuf buf(client_sock);
+    std::istream in(&buf);
+    std::string command;
+    while (in >> command) {
+        std::ostringstream out;
+        uint64_t id;
+        if (command == "CONNECTIONS") adminConnections(out);
+        else if (command == "JOBS") adminJobs(out);
+        else if (command == "QUEUES") adminQueues(out);
+        else if (command == "METRICS") out << metricsReport();
+        else if (command == "LOCKS") adminLocks(out);
+        else if (command == "TENANTS") adminTenants(out);
+        else if (command == "CANCEL" && in >> id) out << (scheduler.cancel(id) ? "OK\n" : "FAIL\n");
+        else out << "ERROR\n";
+        if (!sendAll(client_sock, out.str()) || !in) break;
+    }
+    close(client_sock);
+}
+
+/// @brief Создать слушающий сокет
+/// @param type SOCK_STREAM или SOCK_DGRAM
+/// @param port Порт TCP/UDP
+/// @return Дескриптор сокета
+/// @throws std::runtime_error при ошибке привязки
+int listenInet(int type, int port) {
+    int fd = socket(AF_INET, type, 0);
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in address{AF_INET, htons(port), INADDR_ANY};
+    if (bind(fd, (sockaddr*)&address, sizeof(address)) < 0)
+        throw std::runtime_error("Cannot bind port " + std::to_string(port));
+    if (type == SOCK_STREAM) listen(fd, SOMAXCONN);
+    return fd;
+}
+
+/// @brief Создать слушающий Unix-сокет
+/// @param path Путь к сокету (существующий файл заменяется)
+/// @param mode Права файла сокета, 0 — по umask процесса
+/// @throws std::runtime_error при ошибке привязки или если права шире заданных
+///
+/// Права задаются маской на время bind, а не chmod после него: иначе между bind и
+/// chmod к сокету успевает подключиться любой локальный пользователь.
+int listenUnix(const char* path, mode_t mode = 0) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    unlink(path);
+    mode_t previous = mode ? umask(~mode & 0777) : 0;
+    int bound = bind(fd, (sockaddr*)&address, sizeof(address));
+    if (mode) umask(previous);
+    if (bound < 0) throw std::runtime_error(std::string("Cannot bind ") + path);
+    struct stat info;
+    if (mode && (stat(path, &info) < 0 || (info.st_mode & 0777 & ~mode)))
+        throw std::runtime_error(std::string("Cannot restrict permissions of ") + path);
+    listen(fd, SOMAXCONN);
+    return fd;
+}
+
+/// @brief Создать канал в общей памяти
+/// @param name Имя сегмента
+/// @return Отображённый и инициализированный канал
+ShmChannel* createSharedMemory(const char* name) {
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+    if (fd < 0 || ftruncate(fd, sizeof(ShmChannel)) < 0)
+        throw std::runtime_error(std::string("Cannot create ") + name);
+    void* mem = mmap(nullptr, sizeof(ShmChannel), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) throw std::runtime_error(std::string("Cannot map ") + name);
+    ShmChannel* channel = static_cast<ShmChannel*>(mem);
+    sem_init(&channel->lock, 1, 1);
+    sem_init(&channel->request, 1, 0);
+    sem_init(&channel->response, 1, 0);
+    channel->sequence = channel->answered = 0;
+    channel->length = 0;
+    return channel;
+}
+
+/// @brief Основная функция сервера
+///
+/// Параметры: --workers N (начальное число вычислительных потоков, по умолчанию число ядер),
+/// --min-workers N и --max-workers N (границы подстройки, по умолчанию 1 и число ядер).
+/// При равных границах число потоков не подстраивается. --tenant имя:вес:квота задаёт
+/// долю процессора и предел параллельных заданий арендатора (можно повторять).
+/// --batch-window-us N — сколько запрос отсечения ждёт попутчиков с тем же окном (по умолчанию 0).
+int main(int argc, char** argv) {
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    unsigned workers = cores, minWorkers = 1, maxWorkers = cores;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        if (key == "--workers") workers = std::stoul(argv[i + 1]);
+        else if (key == "--min-workers") minWorkers = std::stoul(argv[i + 1]);
+        else if (key == "--max-workers") maxWorkers = std::stoul(argv[i + 1]);
+        else if (key == "--batch-window-us") scheduler.setBatchWindow(std::stoll(argv[i + 1]));
+        else if (key == "--tenant") {
+            std::istringstream spec(argv[i + 1]);
+            std::string name;
+            double weight;
+            unsigned quota;
+            char colon;
+            Tenant* tenant = nullptr;
+            try {
+                if (std::getline(spec, name, ':') && spec >> weight >> colon >> quota && colon == ':' &&
+                    weight > 0 && quota > 0)
+                    tenant = &tenants.create(name);
+            } catch (const std::exception&) {}
+            if (!tenant) {
+                std::cerr << "Bad tenant " << argv[i + 1] << " (expected name:weight:quota)\n";
+                return 1;
+            }
+            tenant->weight = weight;
+            tenant->quota = quota;
+        }
+        else {
+            std::cerr << "Unknown option " << key << "\n";
+            return 1;
+        }
+    }
+    maxWorkers = std::max(maxWorkers, workers);
+    minWorkers = std::min(minWorkers, workers);
+    if (minWorkers < 1 || maxWorkers > SCHEDULER_MAX_WORKERS) {
+        std::cerr << "Worker bounds must be within 1.." << SCHEDULER_MAX_WORKERS << "\n";
+        return 1;
+    }
+    scheduler.resize(workers);
+
+    int server_fd = listenInet(SOCK_STREAM, TCP_PORT);
+    int persistent_fd = listenInet(SOCK_STREAM, TCP_PERSISTENT_PORT);
+    int unix_fd = listenUnix(UNIX_SOCKET_PATH);
+    int admin_fd = listenUnix(ADMIN_SOCKET_PATH, 0600);
+    int udp_fd = listenInet(SOCK_DGRAM, UDP_PORT);
+    ShmChannel* channel = createSharedMemory(SHM_NAME);
+    std::cout << "Server listening on port " << TCP_PORT
+              << " (persistent " << TCP_PERSISTENT_PORT << ", udp " << UDP_PORT
+              << ", unix " << UNIX_SOCKET_PATH << ", shm " << SHM_NAME << ", admin " << ADMIN_SOCKET_PATH
+              << ")..." << std::endl;
+
+    for (unsigned i = 0; i < maxWorkers; ++i) std::thread(serveUdp, udp_fd).detach();
+    std::thread(serveSharedMemory, channel).detach();
+    eventLoopBeat = steadyNs();
+    std::thread(watchdog).detach();
+    WorkerTuner tuner(minWorkers, maxWorkers);
+    if (minWorkers < maxWorkers) std::thread(&WorkerTuner::run, &tuner).detach();
+
+    pollfd fds[] = {{server_fd, POLLIN, 0}, {persistent_fd, POLLIN, 0}, {unix_fd, POLLIN, 0}, {admin_fd, POLLIN, 0}};
+    while (true) {
+        eventLoopBeat = steadyNs();
+        if (poll(fds, 4, WATCHDOG_INTERVAL_MS) <= 0) continue;
+        for (pollfd& pfd : fds) {
+            if (!(pfd.revents & POLLIN)) continue;
+            int client_sock = accept(pfd.fd, nullptr, nullptr);
+            if (client_sock < 0) continue;
+            if (pfd.fd == server_fd) std::thread(serveSingleRequest, client_sock).detach();
+            else if (pfd.fd == persistent_fd) std::thread(servePersistent, client_sock, "tcp-persistent").detach();
+            else if (pfd.fd == unix_fd) std::thread(servePersistent, client_sock, "unix").detach();
+            else std::thread(serveAdmin, client_sock).detach();
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,121 @@
+/// @file transport.h
+/// @brief Общие параметры транспортов сервера отсечения и вспомогательные функции ввода-вывода
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <streambuf>
+#include <string>
+#include <semaphore.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/// @brief TCP: одно соединение на запрос (исходный режим)
+constexpr int TCP_PORT = 8080;
+/// @brief TCP: постоянное соединение, запросы идут друг за другом
+constexpr int TCP_PERSISTENT_PORT = 8081;
+/// @brief UDP: одна датаграмма на запрос и одна на ответ
+constexpr int UDP_PORT = 8080;
+/// @brief Unix-сокет с постоянным соединением
+constexpr const char* UNIX_SOCKET_PATH = "/tmp/polygon_alg.sock";
+/// @brief Административный Unix-сокет (доступен только владельцу процесса)
+constexpr const char* ADMIN_SOCKET_PATH = "/tmp/polygon_alg.admin.sock";
+/// @brief Имя сегмента общей памяти
+constexpr const char* SHM_NAME = "/polygon_alg";
+/// @brief Максимальный размер запроса или ответа в общей памяти
+constexpr uint32_t SHM_CAPACITY = 1u << 20;
+/// @brief Таймаут чтения запроса в исходном режиме, секунды
+constexpr int SINGLE_REQUEST_TIMEOUT_SEC = 5;
+/// @brief Максимальный размер UDP-датаграммы
+constexpr size_t UDP_MAX_DATAGRAM = 65507;
+
+/// @struct ShmChannel
+/// @brief Канал обмена через общую память: один запрос в обработке одновременно
+///
+/// Клиент захватывает lock, кладёт запрос в data, увеличивает sequence, поднимает request
+/// и ждёт response. Сервер отвечает в тот же буфер, записывает номер запроса в answered
+/// и поднимает response; lock освобождает клиент. Если sequence != answered, предыдущий
+/// клиент ушёл по таймауту и ответ ещё придёт: его нужно дождаться и отбросить,
+/// прежде чем писать новый запрос.
+struct ShmChannel {
+    sem_t lock;           ///< Взаимное исключение клиентов
+    sem_t request;        ///< Запрос готов к обработке
+    sem_t response;       ///< Ответ готов
+    uint32_t sequence;    ///< Номер последнего запроса (пишет клиент)
+    uint32_t answered;    ///< Номер запроса, на который записан ответ (пишет сервер)
+    uint32_t length;      ///< Длина данных в буфере
+    char data[SHM_CAPACITY]; ///< Запрос или ответ
+};
+
+/// @brief Отправить буфер целиком
+/// @return false при ошибке сокета
+inline bool sendAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+/// @brief Отправить строку целиком
+inline bool sendAll(int fd, const std::string& s) { return sendAll(fd, s.data(), s.size()); }
+
+/// @class FdStreamBuf
+/// @brief Буфер потока поверх потокового сокета для разбора запросов на постоянном соединении
+class FdStreamBuf : public std::streambuf {
+public:
+    /// @brief Конструктор
+    /// @param fd Дескриптор сокета (не закрывается буфером)
+    explicit FdStreamBuf(int fd) : _fd(fd), _total(0), _captureFrom(_buf), _captureLimit(0) { setg(_buf, _buf, _buf); }
+
+    /// @brief Сколько байт прочитано из сокета
+    uint64_t bytesRead() const { return _total; }
+
+    /// @brief Начать запись разбираемых байт (для диагностики зависших запросов)
+    /// @param limit Наибольший объём записи
+    void beginCapture(size_t limit) {
+        _capture.clear();
+        _captureFrom = gptr();
+        _captureLimit = limit;
+    }
+
+    /// @brief Закончить запись и вернуть байты, разобранные с её начала (не больше limit)
+    std::string endCapture() {
+        appendCapture(gptr());
+        _captureLimit = 0;
+        return std::move(_capture);
+    }
+
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+        appendCapture(egptr());
+        _captureFrom = _buf;
+        ssize_t n;
+        do n = recv(_fd, _buf, sizeof(_buf), 0); while (n < 0 && errno == EINTR);
+        if (n <= 0) return traits_type::eof();
+        _total += n;
+        setg(_buf, _buf, _buf + n);
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    /// @brief Дописать в запись байты буфера до end
+    void appendCapture(const char* end) {
+        if (_capture.size() < _captureLimit)
+            _capture.append(_captureFrom, std::min<size_t>(end - _captureFrom, _captureLimit - _capture.size()));
+        _captureFrom = end;
+    }
+
+    int _fd;              ///< Дескриптор сокета
+    uint64_t _total;      ///< Счётчик прочитанных байт
+    char _buf[4096];      ///< Буфер чтения
+    std::string _capture; ///< Записанные байты
+    const char* _captureFrom; ///< Начало ещё не записанной части буфера
+    size_t _captureLimit; ///< Наибольший объём записи, 0 — запись выключена
+};